@@ -9,6 +9,7 @@ PREFIX = """@prefix atom:  <http://lv2plug.in/ns/ext/atom#> .
 @prefix pg:   <http://ll-plugins.nongnu.org/lv2/ext/portgroups#>.
 @prefix rdf:  <http://www.w3.org/1999/02/22-rdf-syntax-ns#>.
 @prefix rdfs: <http://www.w3.org/2000/01/rdf-schema#>.
+@prefix state: <http://lv2plug.in/ns/ext/state#>.
 @prefix ui:    <http://lv2plug.in/ns/extensions/ui#>.
 @prefix urid:  <http://lv2plug.in/ns/ext/urid#>.
 
@@ -31,6 +32,8 @@ PREFIX = """@prefix atom:  <http://lv2plug.in/ns/ext/atom#> .
   doap:license <http://usefulinc.com/doap/licenses/gpl>;
   ll:pegName "p";
   ui:ui <http://www.github.com/timowest/rogue/ui> ;
+  lv2:requiredFeature urid:map ;
+  lv2:extensionData state:interface ;
 
   lv2:port [
     a lv2:InputPort, atom:AtomPort;
@@ -112,6 +115,17 @@ def ttl_control(idx, symbol, name, min, max, default):
     lv2:default %s
   ]""" % (idx, symbol, name, _min, _max, _default)
 
+def ttl_output(idx, symbol, name, min, max, properties):
+    return """ , [
+    a lv2:ControlPort, lv2:OutputPort;
+    lv2:index %s;
+    lv2:symbol "%s";
+    lv2:name "%s";
+    lv2:minimum %s;
+    lv2:maximum %s%s
+  ]""" % (idx, symbol, name, float(min), float(max),
+          ";\n    lv2:portProperty " + properties if properties else "")
+
 def port_meta(symbol, min, max, default, step):
     return '    {"%s", %s, %s, %s, %s},' % (symbol, min, max, default, step)
 
@@ -182,8 +196,9 @@ def main():
             ["retrigger"  , 0, 1, 0, 1]] # toggled
                         
     mods = [["src"        , 0, 16, 0, 1],
-            ["target"     , 0, 43, 0, 1],
-            ["amount"     , -1.0, 1.0, 0, 0.01]]        
+            ["target"     , 0, 44, 0, 1],
+            ["amount"     , -1.0, 1.0, 0, 0.01],
+            ["audio"      , 0, 1, 0, 1]] # toggled
 
     idx = 3
 
@@ -207,27 +222,49 @@ def main():
                ["bus_a_pan",   0, 1.0, 0.5, 0.01],
                ["bus_b_level", 0, 1.0, 0, 0.01],
                ["bus_b_pan",   0, 1.0, 0.5, 0.01],
+               ["unison_voices", 1, 8, 1, 1],
+               ["unison_detune", 0, 1.0, 0.2, 0.01],
+               ["unison_spread", 0, 1.0, 0.5, 0.01],
                ["volume",      0, 1.0, 0.5, 0.01],
 
                ["play_mode",   0, 2, 0, 1],
+               ["voice_steal", 0, 3, 0, 1],
+               ["polyphony",   1, 128, 32, 1],
                ["glide_time",  0, 5.0, 0, 0.01],
                ["pitchbend_range",  0, 24.0, 0, 0.1],
+               ["tuning",      0, 15, 0, 1],
+               ["control_rate", 0, 3, 3, 1],
+               ["fx_thread",   0, 1, 0, 1],
+               ["limiter_on",  0, 1, 0, 1],
+               ["limiter_ceiling", -12.0, 0.0, -0.3, 0.1],
+               ["governor_on", 0, 1, 0, 1],
+               ["load_high",   0.1, 1.0, 0.7, 0.01],
+               ["load_low",    0.05, 1.0, 0.4, 0.01],
+               ["multi_on",    0, 1, 0, 1],
+               ["edit_part",   0, 15, 0, 1],
+               ["part_voices", 1, 128, 128, 1],
+               ["part_send",   0, 1.0, 1.0, 0.01],
 
                ["chorus_on",     0, 1, 0, 1],
+               ["chorus_order",  0, 4, 0, 1],
                ["chorus_delay",  0.001, 0.05, 0.02, 0.001],
                ["chorus_amount", 0, 1.0, 0.3, 0.01],
                ["chorus_rate",   0, 10, 0.2, 0.1],
                ["chorus_depth",  0, 1, 0.3, 0.01],
                ["chorus_feedback", 0, 0.99, 0.0, 0.01],
+               ["chorus_taps",   1, 4, 1, 1],
 
                ["phaser_on",     0, 1, 0, 1],
+               ["phaser_order",  0, 4, 1, 1],
                ["phaser_min_freq",   300, 10000, 300, 50],
                ["phaser_max_freq",   300, 10000, 1000, 50],
                ["phaser_rate",   0, 10, 1, 0.1],
                ["phaser_depth", 0, 1, 0.3, 0.01],
                ["phaser_feedback", 0, 0.99, 0.5, 0.01],
+               ["phaser_stages", 4, 12, 8, 4],
 
                ["delay_on",      0, 1, 0, 1],
+               ["delay_order",   0, 4, 2, 1],
                ["delay_bpm",     30, 164, 97, 0.1],
                ["delay_divider_l", 0.01, 1.0, 1, 0.01],
                ["delay_divider_r", 0.01, 1.0, 1, 0.01],
@@ -238,17 +275,36 @@ def main():
                ["delay_highcut", 100, 15000, 10000, 100],
                
                ["reverb_on",     0, 1, 0, 1],
+               ["reverb_order",  0, 4, 3, 1],
                ["reverb_predelay", 0.01, 0.1, 0.01, 0.001],
                ["reverb_decay", 0.01, 1, 0.5, 0.01],
                ["reverb_lowcut",  10, 10000, 10, 100],
                ["reverb_highcut", 100, 15000, 10000, 100],
-               ["reverb_depth",  0, 1, 0.3, 0.01]]
+               ["reverb_depth",  0, 1, 0.3, 0.01],
+
+               ["conv_on",       0, 1, 0, 1],
+               ["conv_order",    0, 4, 4, 1],
+               ["conv_ir",       0, 15, 0, 1],
+               ["conv_depth",    0, 1, 0.3, 0.01]]
 
     for c in globals:
         ttl.append(ttl_control(idx, c[0], c[0], c[1], c[2], c[3]))
         gui.append(port_meta(c[0], c[1], c[2], c[3], c[4]))
         idx += 1
 
+    # latency of the effects pipeline and the limiter in samples, cpu load
+    # as a fraction of the period, degradation level of the governor and
+    # the number of periods that came close to an xrun
+    outputs = [["latency",     0, 8192, 0, 1, "lv2:reportsLatency, lv2:integer"],
+               ["cpu_load",    0, 2.0, 0, 0.01, ""],
+               ["degradation", 0, 3, 0, 1, "lv2:integer"],
+               ["xrun_risk",   0, 1000000, 0, 1, "lv2:integer"]]
+
+    for c in outputs:
+        ttl.append(ttl_output(idx, c[0], c[0], c[1], c[2], c[5]))
+        gui.append(port_meta(c[0], c[1], c[2], c[3], c[4]))
+        idx += 1
+
     ttl.append(".")
 
     gui.append("};")
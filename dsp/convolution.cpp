@@ -0,0 +1,454 @@
+/*
+ * rogue - multimode synth
+ *
+ * Copyright (C) 2013 Timo Westkämper
+ */
+
+#include "convolution.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <fftw3.h>
+#include <samplerate.h>
+#include <sndfile.hh>
+
+namespace dsp {
+
+// FFT plans, created once and shared, execution is thread safe
+
+static std::mutex planner_mutex;
+
+struct FFTPlans {
+    fftwf_plan forward, inverse;
+};
+
+// creates the plans on first use, not realtime safe
+static const FFTPlans& plans(uint n) {
+    static FFTPlans head, tail;
+    std::lock_guard<std::mutex> lock(planner_mutex);
+    FFTPlans& p = n == 2 * ImpulseResponse::HEAD ? head : tail;
+    if (!p.forward) {
+        float* time = (float*) fftwf_malloc(sizeof(float) * n);
+        fftwf_complex* freq = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * (n / 2 + 1));
+        p.forward = fftwf_plan_dft_r2c_1d(n, time, freq, FFTW_ESTIMATE);
+        p.inverse = fftwf_plan_dft_c2r_1d(n, freq, time, FFTW_ESTIMATE);
+        fftwf_free(time);
+        fftwf_free(freq);
+    }
+    return p;
+}
+
+static void fft(const FFTPlans* p, float* time, float* freq) {
+    fftwf_execute_dft_r2c(p->forward, time, (fftwf_complex*) freq);
+}
+
+static void ifft(const FFTPlans* p, float* freq, float* time) {
+    fftwf_execute_dft_c2r(p->inverse, (fftwf_complex*) freq, time);
+}
+
+// complex multiply accumulate of interleaved spectra
+static void mac(float* acc, const float* x, const float* h, uint bins) {
+    for (uint b = 0; b < 2 * bins; b += 2) {
+        acc[b]     += x[b] * h[b]     - x[b + 1] * h[b + 1];
+        acc[b + 1] += x[b] * h[b + 1] + x[b + 1] * h[b];
+    }
+}
+
+// spectra of the partitions of taps [from, to), scaled for the inverse transform
+static void partition(const float* taps, uint length, uint from, uint to, uint n, std::vector<float>& out) {
+    to = std::min(to, length);
+    uint parts = to > from ? (to - from + n - 1) / n : 0;
+    out.assign(parts * (n + 1) * 2, 0.0f);
+    float* time = (float*) fftwf_malloc(sizeof(float) * 2 * n);
+    float* freq = (float*) fftwf_malloc(sizeof(fftwf_complex) * (n + 1));
+    const FFTPlans* ps = &plans(2 * n);
+    for (uint p = 0; p < parts; p++) {
+        for (uint i = 0; i < 2 * n; i++) {
+            uint t = from + p * n + i;
+            time[i] = (i < n && t < to) ? taps[t] / float(2 * n) : 0.0f;
+        }
+        fft(ps, time, freq);
+        std::copy(freq, freq + (n + 1) * 2, out.begin() + p * (n + 1) * 2);
+    }
+    fftwf_free(time);
+    fftwf_free(freq);
+}
+
+// ImpulseResponse
+
+ImpulseResponse::ImpulseResponse(const float* const* data, uint channels_, uint length_) {
+    channels = std::min(channels_, 2u);
+    length = length_;
+    for (uint c = 0; c < channels; c++) {
+        head[c].assign(HEAD, 0.0f);
+        for (uint t = 0; t < HEAD && t < length; t++) {
+            head[c][HEAD - 1 - t] = data[c][t];
+        }
+        partition(data[c], length, HEAD, 2 * TAIL, HEAD, stage1[c]);
+        partition(data[c], length, 2 * TAIL, length, TAIL, stage2[c]);
+    }
+    parts1 = stage1[0].size() / ((HEAD + 1) * 2);
+    parts2 = stage2[0].size() / ((TAIL + 1) * 2);
+}
+
+std::shared_ptr<const ImpulseResponse> ImpulseResponse::load(const char* path, float sample_rate, uint max_length) {
+    static std::mutex cache_mutex;
+    static std::map<std::string, std::weak_ptr<const ImpulseResponse> > cache;
+
+    char key[32];
+    snprintf(key, sizeof(key), "@%d", int(sample_rate));
+    std::string id = std::string(path) + key;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::shared_ptr<const ImpulseResponse> ir = cache[id].lock();
+    if (ir) {
+        return ir;
+    }
+
+    SndfileHandle file(path);
+    if (!file || file.frames() == 0) {
+        return ir;
+    }
+    uint channels = file.channels();
+    std::vector<float> frames(file.frames() * channels);
+    file.readf(&frames[0], file.frames());
+
+    // resample
+    uint length = file.frames();
+    if (file.samplerate() != int(sample_rate)) {
+        double ratio = sample_rate / file.samplerate();
+        std::vector<float> resampled(uint(length * ratio + 1) * channels);
+        SRC_DATA src;
+        src.data_in = &frames[0];
+        src.data_out = &resampled[0];
+        src.input_frames = length;
+        src.output_frames = resampled.size() / channels;
+        src.end_of_input = 1;
+        src.src_ratio = ratio;
+        src_simple(&src, SRC_SINC_MEDIUM_QUALITY, channels);
+        length = src.output_frames_gen;
+        frames.swap(resampled);
+    }
+    length = std::min(length, max_length);
+
+    // deinterleave the first two channels, normalized to unit energy
+    uint used = std::min(channels, 2u);
+    std::vector<float> taps[2];
+    float energy = 0.0f;
+    for (uint c = 0; c < used; c++) {
+        taps[c].resize(length);
+        float e = 0.0f;
+        for (uint i = 0; i < length; i++) {
+            taps[c][i] = frames[i * channels + c];
+            e += taps[c][i] * taps[c][i];
+        }
+        energy = std::max(energy, e);
+    }
+    float gain = energy > 0.0f ? 1.0f / sqrtf(energy) : 1.0f;
+    for (uint c = 0; c < used; c++) {
+        for (uint i = 0; i < length; i++) {
+            taps[c][i] *= gain;
+        }
+    }
+
+    const float* data[2] = {&taps[0][0], used > 1 ? &taps[1][0] : 0};
+    ir = std::make_shared<const ImpulseResponse>(data, used, length);
+    cache[id] = ir;
+    return ir;
+}
+
+// Convolver
+
+Convolver::Convolver() {
+    const uint H = ImpulseResponse::HEAD, T = ImpulseResponse::TAIL;
+    plans1 = &plans(2 * H);
+    plans2 = &plans(2 * T);
+    time1 = (float*) fftwf_malloc(sizeof(float) * 2 * H);
+    freq1 = (float*) fftwf_malloc(sizeof(fftwf_complex) * (H + 1));
+    time2 = (float*) fftwf_malloc(sizeof(float) * 2 * T);
+    freq2 = (float*) fftwf_malloc(sizeof(fftwf_complex) * (T + 1));
+    fdl1.assign((2 * T - H) / H * (H + 1) * 2, 0.0f);
+    clear();
+    clearTail();
+}
+
+Convolver::~Convolver() {
+    fftwf_free(time1);
+    fftwf_free(freq1);
+    fftwf_free(time2);
+    fftwf_free(freq2);
+}
+
+void Convolver::setMax(uint parts2) {
+    max_parts2 = parts2;
+    fdl2.assign(parts2 * (ImpulseResponse::TAIL + 1) * 2, 0.0f);
+    fdl2_pos = 0;
+}
+
+void Convolver::clear() {
+    std::fill(hist, hist + 2 * ImpulseResponse::HEAD, 0.0f);
+    std::fill(in1, in1 + ImpulseResponse::HEAD, 0.0f);
+    std::fill(prev1, prev1 + ImpulseResponse::HEAD, 0.0f);
+    std::fill(out1, out1 + ImpulseResponse::HEAD, 0.0f);
+    std::fill(in2, in2 + ImpulseResponse::TAIL, 0.0f);
+    std::fill(out2, out2 + ImpulseResponse::TAIL, 0.0f);
+    std::fill(fdl1.begin(), fdl1.end(), 0.0f);
+    fdl1_pos = 0;
+}
+
+void Convolver::clearTail() {
+    std::fill(prev2, prev2 + ImpulseResponse::TAIL, 0.0f);
+    std::fill(fdl2.begin(), fdl2.end(), 0.0f);
+    fdl2_pos = 0;
+}
+
+void Convolver::process(const ImpulseResponse* ir, uint ch, const float* input, float* output,
+                        uint pos1, uint pos2, uint samples) {
+    const uint H = ImpulseResponse::HEAD;
+    const float* h = &ir->head[ch][0];
+    float* x = hist + H - 1;
+    for (uint i = 0; i < samples; i++) {
+        x[i] = input[i];
+    }
+    // direct form head
+    for (uint i = 0; i < samples; i++) {
+        float y = 0.0f;
+        for (uint t = 0; t < H; t++) {
+            y += h[t] * hist[i + t];
+        }
+        output[i] = y + out1[pos1 + i] + out2[pos2 + i];
+    }
+    for (uint i = 0; i < samples; i++) {
+        in1[pos1 + i] = input[i];
+        in2[pos2 + i] = input[i];
+    }
+    std::copy(hist + samples, hist + samples + H - 1, hist);
+}
+
+// uniformly partitioned overlap-save step, output is the second half of time
+#define UPOLS_STEP(n, plans, time, freq, prev, input, fdl, fdl_pos, parts, spectra) \
+    std::copy(prev, prev + n, time); \
+    std::copy(input, input + n, time + n); \
+    std::copy(input, input + n, prev); \
+    fft(plans, time, freq); \
+    std::copy(freq, freq + (n + 1) * 2, &fdl[fdl_pos * (n + 1) * 2]); \
+    std::fill(freq, freq + (n + 1) * 2, 0.0f); \
+    for (uint p = 0; p < parts; p++) { \
+        uint slot = (fdl_pos + parts_max - p) % parts_max; \
+        mac(freq, &fdl[slot * (n + 1) * 2], &spectra[p * (n + 1) * 2], n + 1); \
+    } \
+    fdl_pos = (fdl_pos + 1) % parts_max; \
+    ifft(plans, freq, time);
+
+void Convolver::runHead(const ImpulseResponse* ir, uint ch) {
+    const uint H = ImpulseResponse::HEAD;
+    const uint parts_max = fdl1.size() / ((H + 1) * 2);
+    const std::vector<float>& spectra = ir->stage1[ch];
+    UPOLS_STEP(H, plans1, time1, freq1, prev1, in1, fdl1, fdl1_pos, ir->parts1, spectra)
+    std::copy(time1 + H, time1 + 2 * H, out1);
+}
+
+void Convolver::runTail(const ImpulseResponse* ir, uint ch, const float* input, float* output) {
+    const uint T = ImpulseResponse::TAIL;
+    const uint parts = std::min(ir->parts2, max_parts2);
+    if (parts == 0) {
+        std::fill(output, output + T, 0.0f);
+        return;
+    }
+    const uint parts_max = max_parts2;
+    const std::vector<float>& spectra = ir->stage2[ch];
+    UPOLS_STEP(T, plans2, time2, freq2, prev2, input, fdl2, fdl2_pos, parts, spectra)
+    std::copy(time2 + T, time2 + 2 * T, output);
+}
+
+// ConvolutionReverb
+
+ConvolutionReverb::ConvolutionReverb() {
+    ir_ready = false;
+    requested = 0;
+    job_state = IDLE;
+    load_job.reverb = this;
+}
+
+void ConvolutionReverb::clear() {
+    conv[0].clear();
+    conv[1].clear();
+    pos1 = pos2 = 0;
+    // a job in flight belongs to the cleared state
+    job_dropped = job_state.load(std::memory_order_acquire) != IDLE;
+    tail_reset = true;
+    gap = false;
+}
+
+void ConvolutionReverb::setSamplerate(float r) {
+    sample_rate = r;
+    uint parts2 = (MAX_SECONDS * r) / TAIL + 1;
+    conv[0].setMax(parts2);
+    conv[1].setMax(parts2);
+}
+
+void ConvolutionReverb::setCoefficients(float _depth) {
+    depth = _depth;
+}
+
+void ConvolutionReverb::setImpulse(std::shared_ptr<const ImpulseResponse> ir) {
+    // not realtime safe, used before processing
+    current = ir;
+    clear();
+}
+
+void ConvolutionReverb::request(const char* path) {
+    requested = path;
+    postLoad();
+}
+
+void ConvolutionReverb::postLoad() {
+    Worker* w = loader ? loader : worker;
+    if (!w) {
+        load();
+        load_failed = false;
+    } else {
+        load_failed = !w->post(&load_job);
+    }
+}
+
+void ConvolutionReverb::load() {
+    const char* path = ir_ready.load(std::memory_order_acquire) ? 0 : requested.exchange(0);
+    if (path) {
+        // the previous response is released here
+        next = ImpulseResponse::load(path, sample_rate, MAX_SECONDS * sample_rate);
+        ir_ready.store(true, std::memory_order_release);
+    }
+}
+
+void ConvolutionReverb::work() {
+    runJob();
+    job_state.store(DONE, std::memory_order_release);
+}
+
+void ConvolutionReverb::runJob() {
+    if (job_reset || job_ir != tail_ir) {
+        conv[0].clearTail();
+        conv[1].clearTail();
+        tail_ir = job_ir;
+    } else if (job_gap) {
+        // the block skipped for the late job, its output is past
+        for (uint c = 0; c < 2; c++) {
+            uint ch = job_ir->channels > 1 ? c : 0;
+            conv[c].runTail(job_ir, ch, gap_in[c], job_out[c]);
+        }
+    }
+    for (uint c = 0; c < 2; c++) {
+        uint ch = job_ir->channels > 1 ? c : 0;
+        conv[c].runTail(job_ir, ch, job_in[c], job_out[c]);
+    }
+}
+
+void ConvolutionReverb::tailBoundary() {
+    // result of the previous block, unless the worker is late with it
+    int state = job_state.load(std::memory_order_acquire);
+    if (state == DONE && !job_dropped) {
+        std::copy(job_out[0], job_out[0] + TAIL, conv[0].out2);
+        std::copy(job_out[1], job_out[1] + TAIL, conv[1].out2);
+    } else {
+        std::fill(conv[0].out2, conv[0].out2 + TAIL, 0.0f);
+        std::fill(conv[1].out2, conv[1].out2 + TAIL, 0.0f);
+    }
+    if (state == DONE) {
+        job_state = state = IDLE;
+        job_dropped = false;
+    } else if (state == PENDING) {
+        // its result would arrive a block late, this block's tail input
+        // waits for the next job
+        job_dropped = true;
+        if (gap) {
+            tail_reset = true;
+            gap = false;
+        } else {
+            std::copy(conv[0].in2, conv[0].in2 + TAIL, gap_in[0]);
+            std::copy(conv[1].in2, conv[1].in2 + TAIL, gap_in[1]);
+            gap = true;
+        }
+    }
+
+    // swap in a loaded response once no job uses the current one, the
+    // previous one is released by the loader
+    if (state == IDLE && ir_ready.load(std::memory_order_acquire)) {
+        current.swap(next);
+        ir_ready.store(false, std::memory_order_release);
+        clear();
+        // a request that came in while the response was waiting
+        if (requested) {
+            postLoad();
+        }
+        return;
+    }
+
+    if (current && state == IDLE) {
+        std::copy(conv[0].in2, conv[0].in2 + TAIL, job_in[0]);
+        std::copy(conv[1].in2, conv[1].in2 + TAIL, job_in[1]);
+        job_ir = current.get();
+        job_reset = tail_reset;
+        job_gap = gap;
+        tail_reset = gap = false;
+        job_state.store(PENDING, std::memory_order_release);
+        if (!worker) {
+            work();
+        } else if (!worker->post(this)) {
+            // skipped like the block of a late job
+            job_state = IDLE;
+            tail_reset = job_reset || job_gap;
+            gap = !tail_reset;
+            if (gap) {
+                std::copy(job_in[0], job_in[0] + TAIL, gap_in[0]);
+                std::copy(job_in[1], job_in[1] + TAIL, gap_in[1]);
+            }
+        }
+    }
+}
+
+void ConvolutionReverb::process(float* left, float* right, int samples) {
+    if (load_failed) {
+        postLoad();
+    }
+    if (!current && !ir_ready) {
+        return;
+    }
+    float* io[2] = {left, right};
+    const float dry = 1.0f - depth;
+    uint i = 0;
+    while (i < samples) {
+        if (!current) {
+            tailBoundary();
+            if (!current) return;
+        }
+        uint n = std::min(uint(samples) - i, HEAD - pos1);
+        const ImpulseResponse* ir = current.get();
+        for (uint c = 0; c < 2; c++) {
+            uint ch = ir->channels > 1 ? c : 0;
+            conv[c].process(ir, ch, io[c] + i, wet[c], pos1, pos2, n);
+            for (uint j = 0; j < n; j++) {
+                io[c][i + j] = dry * io[c][i + j] + depth * wet[c][j];
+            }
+        }
+        pos1 += n;
+        pos2 += n;
+        i += n;
+        if (pos1 == HEAD) {
+            conv[0].runHead(ir, 0);
+            conv[1].runHead(ir, ir->channels > 1 ? 1 : 0);
+            pos1 = 0;
+        }
+        if (pos2 == TAIL) {
+            tailBoundary();
+            pos2 = 0;
+        }
+    }
+}
+
+}
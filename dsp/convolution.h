@@ -0,0 +1,156 @@
+/*
+ * rogue - multimode synth
+ *
+ * Copyright (C) 2013 Timo Westkämper
+ */
+
+#ifndef DSP_CONVOLUTION_H
+#define DSP_CONVOLUTION_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "types.h"
+#include "effects.h"
+#include "worker.h"
+
+namespace dsp {
+
+struct FFTPlans;
+
+/**
+ * impulse response prepared for partitioned convolution
+ *
+ * The taps are split into a direct form head of HEAD taps, a first stage
+ * of HEAD sized partitions up to 2 * TAIL taps and a second stage of TAIL
+ * sized partitions for the rest. Spectra are stored as interleaved
+ * re/im pairs. Immutable after creation, so instances share it.
+ */
+struct ImpulseResponse {
+    static const uint HEAD = 64;
+    static const uint TAIL = 1024;
+
+    uint channels, length, parts1, parts2;
+    std::vector<float> head[2];   // reversed head taps
+    std::vector<float> stage1[2]; // parts1 * (HEAD + 1) bins
+    std::vector<float> stage2[2]; // parts2 * (TAIL + 1) bins
+
+    ImpulseResponse(const float* const* data, uint channels, uint length);
+
+    /**
+     * loads a WAV file, resampled to the given rate and normalized;
+     * responses are cached and shared while in use. Not realtime safe.
+     */
+    static std::shared_ptr<const ImpulseResponse> load(const char* path, float sample_rate, uint max_length);
+};
+
+/**
+ * zero latency convolution of one channel
+ *
+ * The head and the first stage run in the audio thread, the second stage
+ * (tail) is run by the owner with runTail, possibly on another thread.
+ */
+class Convolver {
+  public:
+    Convolver();
+    ~Convolver();
+    Convolver(const Convolver&) = delete;
+    Convolver& operator=(const Convolver&) = delete;
+    void setMax(uint parts2);
+    void clear();
+    void clearTail();
+    void process(const ImpulseResponse* ir, uint ch, const float* input, float* output, uint pos1, uint pos2, uint samples);
+    void runHead(const ImpulseResponse* ir, uint ch);
+    void runTail(const ImpulseResponse* ir, uint ch, const float* input, float* output);
+
+    float in2[ImpulseResponse::TAIL], out2[ImpulseResponse::TAIL];
+
+  private:
+    // plans of both stages, executed without locking
+    const FFTPlans* plans1;
+    const FFTPlans* plans2;
+
+    // head and first stage, audio thread
+    float hist[2 * ImpulseResponse::HEAD];
+    float in1[ImpulseResponse::HEAD], prev1[ImpulseResponse::HEAD], out1[ImpulseResponse::HEAD];
+    float *time1, *freq1;
+    std::vector<float> fdl1;
+    uint fdl1_pos = 0;
+
+    // second stage
+    float prev2[ImpulseResponse::TAIL];
+    float *time2, *freq2;
+    std::vector<float> fdl2;
+    uint fdl2_pos = 0, max_parts2 = 0;
+};
+
+/**
+ * convolution reverb with impulse responses from WAV files
+ *
+ * The second stage runs on a worker which has a full TAIL block to
+ * compute it. When the worker falls behind, the tail of that block is
+ * dropped instead of waiting for it, and its input is run into the tail
+ * by the next job. Requested responses are loaded by a loader, which
+ * defaults to the worker, and swapped in at a block boundary when no job
+ * is running. Without a worker both run inline.
+ */
+class ConvolutionReverb : public Effect, public Worker::Job {
+    static const uint HEAD = ImpulseResponse::HEAD;
+    static const uint TAIL = ImpulseResponse::TAIL;
+    static const uint MAX_SECONDS = 6;
+
+    enum {IDLE, PENDING, DONE};
+
+    Convolver conv[2];
+    float wet[2][HEAD];
+    uint pos1 = 0, pos2 = 0;
+    float sample_rate, depth = 0.0f;
+
+    // the loader fills next while ir_ready is false, the audio thread
+    // swaps it in and clears the flag, a failed post is retried
+    std::shared_ptr<const ImpulseResponse> current, next;
+    std::atomic<bool> ir_ready;
+    std::atomic<const char*> requested;
+    bool load_failed = false;
+
+    struct LoadJob : Worker::Job {
+        ConvolutionReverb* reverb;
+        void work() { reverb->load(); }
+    } load_job;
+
+    // second stage job, handed over at TAIL boundaries, the result of a
+    // late job or of one started before clear() is dropped, the input
+    // skipped for a late job is run first by the next one, a second late
+    // block before that clears the tail
+    std::atomic<int> job_state;
+    const ImpulseResponse* job_ir = 0;
+    const ImpulseResponse* tail_ir = 0; // worker side
+    bool job_reset = false, tail_reset = true, job_dropped = false;
+    bool job_gap = false, gap = false;
+    float job_in[2][TAIL], job_out[2][TAIL], gap_in[2][TAIL];
+    Worker* worker = 0;
+    Worker* loader = 0;
+
+  public:
+    ConvolutionReverb();
+    void setWorker(Worker* w) { worker = w; }
+    void setLoader(Worker* l) { loader = l; }
+    void clear();
+    void setSamplerate(float r);
+    void setCoefficients(float _depth);
+    void setImpulse(std::shared_ptr<const ImpulseResponse> ir);
+    void request(const char* path);
+    void process(float* left, float* right, int samples);
+    void work();
+    void load();
+
+  private:
+    void postLoad();
+    void runJob();
+    void tailBoundary();
+    uint tailLength() { return current ? current->length + 2 * TAIL : 0; }
+};
+
+}
+
+#endif
@@ -6,35 +6,152 @@
 
 #include "delay.h"
 
+#include <algorithm>
+
 namespace dsp {
 
-// Delay
+// DelayMemory
+
+DelayMemory::~DelayMemory() {
+    delete[] memory;
+    delete[] free_blocks;
+}
+
+void DelayMemory::allocate(uint lines, uint blocks, uint block_length_) {
+    delete[] memory;
+    delete[] free_blocks;
+    lines_size = lines;
+    used = 0;
+    block_length = block_length_;
+    // all pages are touched here, so that the audio thread doesn't fault
+    // them in, users of the blocks clear them as they are read
+    memory = new float[lines + blocks * block_length];
+    std::fill(memory, memory + lines + blocks * block_length, 0.0f);
+    free_blocks = new float*[blocks];
+    free_count = blocks;
+    for (uint i = 0; i < blocks; i++) {
+        free_blocks[i] = memory + lines + (blocks - 1 - i) * block_length;
+    }
+}
+
+float* DelayMemory::take(uint length) {
+    if (used + length > lines_size) {
+        return 0;
+    }
+    float* line = memory + used;
+    used += length;
+    return line;
+}
+
+float* DelayMemory::acquire() {
+    if (free_count == 0) {
+        return 0;
+    }
+    return free_blocks[--free_count];
+}
+
+void DelayMemory::release(float* block) {
+    free_blocks[free_count++] = block;
+}
+
+// DelayBuffer
+
+DelayBuffer::DelayBuffer(uint l) {
+    if (l > 0) {
+        resize(l);
+    }
+}
+
+DelayBuffer::~DelayBuffer() {
+    free();
+}
+
+DelayBuffer::DelayBuffer(DelayBuffer&& other) {
+    *this = static_cast<DelayBuffer&&>(other);
+}
+
+DelayBuffer& DelayBuffer::operator=(DelayBuffer&& other) {
+    if (this != &other) {
+        free();
+        buffer = other.buffer;
+        length = other.length;
+        mask = other.mask;
+        capacity = other.capacity;
+        owned = other.owned;
+        other.buffer = 0;
+        other.length = other.mask = other.capacity = 0;
+        other.owned = false;
+    }
+    return *this;
+}
+
+void DelayBuffer::free() {
+    if (owned) {
+        delete[] buffer;
+    }
+    buffer = 0;
+    owned = false;
+}
+
+void DelayBuffer::attach(float* b, uint l) {
+    free();
+    buffer = b;
+    length = capacity = l;
+    mask = l - 1;
+}
+
+float* DelayBuffer::detach() {
+    float* b = buffer;
+    if (owned) {
+        free();
+        b = 0;
+    }
+    buffer = 0;
+    length = mask = capacity = 0;
+    return b;
+}
 
-Delay::Delay(uint l) {
-    buffer = new float[l];
+void DelayBuffer::resize(uint d) {
+    uint l = next_pow2(d);
+    if (l > capacity) {
+        free();
+        buffer = new float[l]();
+        capacity = l;
+        owned = true;
+    }
     length = l;
-    clear();
+    mask = l - 1;
 }
 
-Delay::~Delay() {
-    delete buffer;
+void DelayBuffer::resize(uint d, DelayMemory& memory) {
+    uint l = next_pow2(d);
+    float* b = memory.take(l);
+    if (b) {
+        attach(b, l);
+    } else {
+        resize(d);
+    }
+}
+
+// Delay
+
+Delay::Delay(uint l) : DelayBuffer(l) {
+    clear();
 }
 
 void Delay::setDelay(uint d) {
-    if (inPoint >= d) outPoint = inPoint - d;
-    else outPoint = length + inPoint - d;
+    outPoint = (inPoint - d) & mask;
     delay = d;
 }
 
 void Delay::setMax(uint d) {
-    if (d > length) {
-        delete buffer;
-        buffer = new float[d];
-        for (uint i = 0; i < d; i++) {
-            buffer[i] = 0;
-        }
-    }
-    length = d;
+    resize(d);
+    clear();
+}
+
+void Delay::setMax(uint d, DelayMemory& memory) {
+    resize(d, memory);
+    clear();
 }
 
 void Delay::clear() {
@@ -42,6 +159,8 @@ void Delay::clear() {
         buffer[i] = 0;
     }
     last = 0;
+    inPoint = 0;
+    setDelay(delay);
 }
 
 float Delay::nextOut() {
@@ -49,106 +168,119 @@ float Delay::nextOut() {
 }
 
 float Delay::process(float in) {
-    buffer[inPoint++] = in;
-    if (inPoint == length) inPoint = 0;
-    last = buffer[outPoint++];
-    if (outPoint == length) outPoint = 0;
+    buffer[inPoint] = in;
+    inPoint = (inPoint + 1) & mask;
+    last = buffer[outPoint];
+    outPoint = (outPoint + 1) & mask;
     return last;
 }
 
+void Delay::read(float* output, uint d, uint samples) {
+    // contiguous segments up to the wrap
+    uint pos = (inPoint - d) & mask;
+    uint first = std::min(samples, length - pos);
+    std::copy(buffer + pos, buffer + pos + first, output);
+    std::copy(buffer, buffer + samples - first, output + first);
+}
+
+void Delay::write(const float* input, uint samples) {
+    uint first = std::min(samples, length - inPoint);
+    std::copy(input, input + first, buffer + inPoint);
+    std::copy(input + first, input + samples, buffer);
+    inPoint = (inPoint + samples) & mask;
+    outPoint = (outPoint + samples) & mask;
+}
+
 // MDelay
 
-MDelay::MDelay(uint l) {
-    buffer = new float[l];
-    length = l;
+MDelay::MDelay(uint l) : DelayBuffer(l) {
     clear();
 }
 
-MDelay::~MDelay() {
-    delete buffer;
+void MDelay::setMax(uint d) {
+    resize(d);
+    clear();
 }
 
-void MDelay::setMax(uint d) {
-    if (d > length) {
-        delete buffer;
-        buffer = new float[d];
-        for (uint i = 0; i < d; i++) {
-            buffer[i] = 0;
-        }
-    }
-    length = d;
+void MDelay::setMax(uint d, DelayMemory& memory) {
+    resize(d, memory);
+    clear();
 }
 
 void MDelay::clear() {
     for (uint i = 0; i < length; i++) {
         buffer[i] = 0;
     }
+    inPoint = 0;
 }
 
 float MDelay::at(int samples) {
-    int outPoint = int(inPoint) - samples;
-    if (outPoint < 0) outPoint += length;
-    return buffer[outPoint];
+    return buffer[(inPoint - samples) & mask];
 }
 
 void MDelay::tick(float in) {
-    buffer[inPoint++] = in;
-    if (inPoint == length) inPoint = 0;
+    buffer[inPoint] = in;
+    inPoint = (inPoint + 1) & mask;
 }
 
 // DelayA
 
-DelayA::DelayA(uint l) {
-    buffer = new float[l];
-    length = l;
+DelayA::DelayA(uint l) : DelayBuffer(l) {
     clear();
 }
 
-DelayA::~DelayA() {
-    //delete buffer; FIXME
-}
-
 void DelayA::setDelay(float delay) {
-    float outPointer = inPoint_ - delay + 1.0; // outPoint chases inpoint
+    float outPointer = inPoint_ - delay + 1.0 + length; // outPoint chases inpoint
     delay_ = delay;
-    while (outPointer < 0) {
-        outPointer += length; // modulo maximum length
-    }
-    outPoint_ = (int) outPointer; // integer part
-    if (outPoint_ == length) {
-        outPoint_ = 0;
-    }
-    alpha_ = 1.0 + outPoint_ - outPointer; // fractional part
+    uint outPoint = (uint) outPointer; // integer part
+    alpha_ = 1.0 + outPoint - outPointer; // fractional part
     if (alpha_ < 0.5) {
         // The optimal range for alpha is about 0.5 - 1.5 in order to
         // achieve the flattest phase delay response.
-        outPoint_ += 1;
-        if (outPoint_ >= length) {
-            outPoint_ -= length;
-        }
+        outPoint += 1;
         alpha_ += 1.0f;
     }
+    outPoint_ = outPoint & mask;
     coeff_ = (1.0 - alpha_) / (1.0 + alpha_); // coefficient for allpass
 }
 
 void DelayA::setMax(uint d) {
-    if (d > length) {
-        delete buffer;
-        buffer = new float[d];
-        for (uint i = 0; i < d; i++) {
-            buffer[i] = 0;
-        }
-    }
-    length = d;
+    resize(d);
+    clear();
+}
+
+void DelayA::setMax(uint d, DelayMemory& memory) {
+    resize(d, memory);
+    clear();
 }
 
 void DelayA::clear() {
     for (uint i = 0; i < length; i++) {
         buffer[i] = 0.0f;
     }
+    clearLazy();
+    unwritten_ = 0;
+}
+
+void DelayA::clearLazy() {
     last_ = 0.0;
     inPoint_ = 0;
     apInput_ = 0.0;
+    unwritten_ = length;
+    setDelay(delay_);
+}
+
+void DelayA::prepare(uint samples) {
+    // the write position hasn't wrapped yet, samples from it on are unwritten
+    if (unwritten_ > 0) {
+        for (uint k = 0; k <= samples; k++) {
+            uint i = (outPoint_ + k) & mask;
+            if (i >= inPoint_) {
+                buffer[i] = 0.0f;
+            }
+        }
+        unwritten_ = unwritten_ > samples ? unwritten_ - samples : 0;
+    }
 }
 
 float DelayA::nextOut() {
@@ -162,56 +294,40 @@ float DelayA::nextOut() {
 }
 
 float DelayA::process(float input) {
-    buffer[inPoint_++] = input;
-    if (inPoint_ == length) {
-        inPoint_ = 0;
-    }
+    buffer[inPoint_] = input;
+    inPoint_ = (inPoint_ + 1) & mask;
     last_ = nextOut();
     doNextOut_ = true;
     // Save the allpass input and increment modulo length.
-    apInput_ = buffer[outPoint_++];
-    if (outPoint_ == length) {
-        outPoint_ = 0;
-    }
+    apInput_ = buffer[outPoint_];
+    outPoint_ = (outPoint_ + 1) & mask;
     return last_;
 }
 
 // DelayL
 
-DelayL::DelayL(uint l) {
-    buffer = new float[l];
-    length = l;
-    inPoint_ = 0;
+DelayL::DelayL(uint l) : DelayBuffer(l) {
     clear();
 }
 
-DelayL::~DelayL() {
-    delete buffer;
-}
-
 void DelayL::setDelay(float delay) {
-    float outPointer = inPoint_ - delay;  // read chases write
+    float outPointer = inPoint_ - delay + length;  // read chases write
     delay_ = delay;
 
-    while (outPointer < 0) {
-        outPointer += length; // modulo maximum length
-    }
-
-    outPoint_ = (uint) outPointer;   // integer part
-    if (outPoint_ == length) outPoint_ = 0;
-    alpha_ = outPointer - outPoint_; // fractional part
+    uint outPoint = (uint) outPointer;   // integer part
+    alpha_ = outPointer - outPoint;      // fractional part
     omAlpha_ = (float) 1.0 - alpha_;
+    outPoint_ = outPoint & mask;
 }
 
 void DelayL::setMax(uint d) {
-    if (d > length) {
-        delete buffer;
-        buffer = new float[d];
-        for (uint i = 0; i < d; i++) {
-            buffer[i] = 0;
-        }
-    }
-    length = d;
+    resize(d);
+    clear();
+}
+
+void DelayL::setMax(uint d, DelayMemory& memory) {
+    resize(d, memory);
+    clear();
 }
 
 void DelayL::clear() {
@@ -219,6 +335,8 @@ void DelayL::clear() {
         buffer[i] = 0.0f;
     }
     last_ = 0.0;
+    inPoint_ = 0;
+    setDelay(delay_);
 }
 
 float DelayL::nextOut() {
@@ -226,26 +344,100 @@ float DelayL::nextOut() {
         // First 1/2 of interpolation
         nextOutput_ = buffer[outPoint_] * omAlpha_;
         // Second 1/2 of interpolation
-        if (outPoint_+ 1 < length)
-          nextOutput_ += buffer[outPoint_+1] * alpha_;
-        else
-          nextOutput_ += buffer[0] * alpha_;
+        nextOutput_ += buffer[(outPoint_ + 1) & mask] * alpha_;
         doNextOut_ = false;
     }
     return nextOutput_;
 }
 
 float DelayL::process(float input) {
-    buffer[inPoint_++] = input;
-    if (inPoint_ == length) {
-        inPoint_ = 0;
-    }
+    buffer[inPoint_] = input;
+    inPoint_ = (inPoint_ + 1) & mask;
     last_ = nextOut();
     doNextOut_ = true;
-    if (++outPoint_ == length) {
-        outPoint_ = 0;
-    }
+    outPoint_ = (outPoint_ + 1) & mask;
     return last_;
 }
 
+// DelayL8
+
+DelayL8::DelayL8(uint l) : DelayBuffer(l * LANES) {
+    clear();
+}
+
+void DelayL8::setMax(uint d) {
+    resize(d * LANES);
+    clear();
+}
+
+void DelayL8::setMax(uint d, DelayMemory& memory) {
+    resize(d * LANES, memory);
+    clear();
+}
+
+void DelayL8::clear() {
+    for (uint i = 0; i < length; i++) {
+        buffer[i] = 0.0f;
+    }
+    inPoint = 0;
+    lines = length / LANES;
+}
+
+void DelayL8::process(const float* input, const float* delay, float* output) {
+    float* frame = buffer + inPoint * LANES;
+    for (uint j = 0; j < LANES; j++) {
+        frame[j] = input[j];
+    }
+    for (uint j = 0; j < LANES; j++) {
+        float pos = float(inPoint + lines) - delay[j]; // read chases write
+        uint i0 = uint(pos);
+        float alpha = pos - float(i0);
+        float y0 = buffer[(i0 * LANES + j) & mask];
+        float y1 = buffer[((i0 + 1) * LANES + j) & mask];
+        output[j] = y0 + alpha * (y1 - y0);
+    }
+    inPoint = (inPoint + 1) & (lines - 1);
+}
+
+// MTapDelay
+
+MTapDelay::MTapDelay(uint l) : DelayBuffer(l * 2) {
+    clear();
+}
+
+void MTapDelay::setMax(uint d) {
+    resize(d * 2);
+    clear();
+}
+
+void MTapDelay::setMax(uint d, DelayMemory& memory) {
+    resize(d * 2, memory);
+    clear();
+}
+
+void MTapDelay::clear() {
+    for (uint i = 0; i < length; i++) {
+        buffer[i] = 0.0f;
+    }
+    inPoint = 0;
+    frames = length / 2;
+}
+
+void MTapDelay::tick(float left, float right) {
+    inPoint = (inPoint + 1) & (frames - 1);
+    buffer[2 * inPoint] = left;
+    buffer[2 * inPoint + 1] = right;
+}
+
+void MTapDelay::read(const float* delay, float* output, uint lanes) {
+    for (uint j = 0; j < lanes; j++) {
+        float pos = float(inPoint + frames) - delay[j]; // read chases write
+        uint i0 = uint(pos);
+        float alpha = pos - float(i0);
+        float y0 = buffer[(2 * i0 + (j & 1)) & mask];
+        float y1 = buffer[(2 * i0 + 2 + (j & 1)) & mask];
+        output[j] = y0 + alpha * (y1 - y0);
+    }
+}
+
 }
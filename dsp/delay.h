@@ -11,6 +11,72 @@
 
 namespace dsp {
 
+/**
+ * smallest power of two that is at least n
+ */
+inline uint next_pow2(uint n) {
+    uint p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+/**
+ * preallocated memory for delay lines
+ *
+ * Allocated once outside of the audio thread. Lines are taken for the
+ * lifetime of the arena, fixed size blocks can be acquired and released
+ * from the audio thread.
+ */
+class DelayMemory {
+
+  public:
+    DelayMemory() {}
+    ~DelayMemory();
+    DelayMemory(const DelayMemory&) = delete;
+    DelayMemory& operator=(const DelayMemory&) = delete;
+    void allocate(uint lines, uint blocks, uint block_length);
+    float* take(uint length);
+    float* acquire();
+    void release(float* block);
+    uint blockLength() const { return block_length; }
+
+  private:
+    float* memory = 0;
+    float** free_blocks = 0;
+    uint lines_size = 0, used = 0, block_length = 0, free_count = 0;
+};
+
+/**
+ * storage for the delay lines below
+ *
+ * The length is a power of two, so that positions wrap with a mask. The
+ * memory is either owned or taken from a DelayMemory arena.
+ */
+class DelayBuffer {
+
+  public:
+    DelayBuffer(uint l = 0);
+    ~DelayBuffer();
+    DelayBuffer(DelayBuffer&& other);
+    DelayBuffer& operator=(DelayBuffer&& other);
+    DelayBuffer(const DelayBuffer&) = delete;
+    DelayBuffer& operator=(const DelayBuffer&) = delete;
+    uint getLength() const { return length; }
+    void attach(float* b, uint l);
+    float* detach();
+
+  protected:
+    void resize(uint d);
+    void resize(uint d, DelayMemory& memory);
+
+    float* buffer = 0;
+    uint length = 0, mask = 0, capacity = 0;
+
+  private:
+    void free();
+    bool owned = false;
+};
+
 /**
  * Delay code based on The Synthesis ToolKit in C++ (STK)
  * by Perry R. Cook and Gary P. Scavone, 1995-2012.
@@ -24,20 +90,25 @@ namespace dsp {
  * instantiation, a fixed maximum length of 4095 and a delay of zero
  * is set.
  */
-class Delay {
+class Delay : public DelayBuffer {
 
   public:
     Delay(uint l = 4096);
-    ~Delay();
     void setDelay(uint d);
     void setMax(uint d);
+    void setMax(uint d, DelayMemory& memory);
     void clear();
     float nextOut();
     float process(float in);
 
+    /** reads the samples delayed by d for the next block, d >= samples */
+    void read(float* output, uint d, uint samples);
+
+    /** writes a block, advancing the write position */
+    void write(const float* input, uint samples);
+
   private:
-    float* buffer;
-    uint length = 4096, delay = 0, inPoint = 0, outPoint = 0;
+    uint delay = 0, inPoint = 0, outPoint = 0;
     float last = 0.0;
 
 };
@@ -45,19 +116,18 @@ class Delay {
 /**
  * Multi tap delay
  */
-class MDelay {
+class MDelay : public DelayBuffer {
 
 public:
   MDelay(uint l = 4096);
-  ~MDelay();
   void setMax(uint d);
+  void setMax(uint d, DelayMemory& memory);
   void clear();
   float at(int samples);
   void tick(float in);
 
 private:
-  float* buffer;
-  uint length = 4096, inPoint = 0;
+  uint inPoint = 0;
 
 };
 
@@ -67,21 +137,27 @@ private:
  * This class implements a fractional-length digital delay-line using
  * a first-order allpass filter.
  */
-class DelayA {
+class DelayA : public DelayBuffer {
 
   public:
     DelayA(uint l = 4096);
-    ~DelayA();
     void setDelay(float d);
     void setMax(uint d);
+    void setMax(uint d, DelayMemory& memory);
     void clear();
     float nextOut();
     float process(float in);
 
+    /** clears without touching the line, prepare() zeroes what is read */
+    void clearLazy();
+
+    /** zeroes the unwritten samples that the next block of process() calls reads */
+    void prepare(uint samples);
+
   private:
-    float* buffer = 0;
-    uint length = 4096, inPoint_, outPoint_;
-    float delay_, alpha_, coeff_, last_ = 0.0;
+    uint unwritten_ = 0; // samples not written since clearLazy()
+    uint inPoint_ = 0, outPoint_ = 0;
+    float delay_ = 0.0, alpha_, coeff_, last_ = 0.0;
     float apInput_ = 0.0, nextOutput_ = 0.0;
     bool doNextOut_ = true;
 };
@@ -94,26 +170,69 @@ class DelayA {
  * are not specified during instantiation, a fixed maximum length of
  * 4095 and a delay of zero is set.
  */
-class DelayL {
+class DelayL : public DelayBuffer {
 
   public:
     DelayL(uint l = 4096);
-    ~DelayL();
     void setDelay(float d);
     void setMax(uint d);
+    void setMax(uint d, DelayMemory& memory);
     void clear();
     float nextOut();
     float process(float in);
 
   private:
-    float* buffer;
-    uint length = 4096, inPoint_, outPoint_;
-    float delay_, alpha_, omAlpha_, last_ = 0.0;
+    uint inPoint_ = 0, outPoint_ = 0;
+    float delay_ = 0.0, alpha_, omAlpha_, last_ = 0.0;
     float nextOutput_ = 0.0;
     bool doNextOut_ = true;
 
 };
 
+/**
+ * bank of 8 linear interpolating delay lines
+ *
+ * The lines share a write position and are stored interleaved, so one
+ * sample of all lines is written and read with lane parallel loops.
+ */
+class DelayL8 : public DelayBuffer {
+
+  public:
+    static const uint LANES = 8;
+
+    DelayL8(uint l = 0);
+    void setMax(uint d);
+    void setMax(uint d, DelayMemory& memory);
+    void clear();
+    void process(const float* input, const float* delay, float* output);
+
+  private:
+    uint inPoint = 0, lines = 0;
+
+};
+
+/**
+ * stereo multi tap delay line
+ *
+ * Left and right are stored as interleaved frames. Taps are read with
+ * linear interpolation in lanes, even lanes from the left channel and odd
+ * lanes from the right.
+ */
+class MTapDelay : public DelayBuffer {
+
+  public:
+    MTapDelay(uint l = 0);
+    void setMax(uint d);
+    void setMax(uint d, DelayMemory& memory);
+    void clear();
+    void tick(float left, float right);
+    void read(const float* delay, float* output, uint lanes);
+
+  private:
+    uint inPoint = 0, frames = 0;
+
+};
+
 }
 
 #endif
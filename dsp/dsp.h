@@ -14,5 +14,6 @@
 #include "lfo.h"
 #include "oscillator.h"
 #include "tables.h"
+#include "tuning.h"
 
 #endif
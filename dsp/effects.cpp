@@ -8,48 +8,131 @@
 #include "tables.h"
 #include <stdlib.h>
 #include <math.h>
+#include <algorithm>
 
 namespace dsp {
 
+// Effect
+
+static const float SILENCE = 1e-5;
+
+bool is_silent(const float* left, const float* right, int samples) {
+    float sum = 0.0f;
+    for (uint i = 0; i < samples; i++) {
+        sum += left[i] * left[i] + right[i] * right[i];
+    }
+    return sum <= 2 * samples * SILENCE * SILENCE;
+}
+
+bool Effect::run(float* left, float* right, int samples) {
+    if (!is_silent(left, right, samples)) {
+        silent = 0;
+        sleeping = false;
+    } else if (sleeping) {
+        return false;
+    } else {
+        silent += samples;
+    }
+    process(left, right, samples);
+    if (silent > 0 && !is_silent(left, right, samples)) {
+        silent = 0; // tail still audible
+    }
+    sleeping = silent > tailLength();
+    return true;
+}
+
 // ChorusEffect
 
 void ChorusEffect::clear() {
-    delay_l.clear();
-    delay_r.clear();
+    delay_line.clear();
     lfo_phase = 0.0;
     last_l = last_r = 0.0;
+    counter = 0;
+    ramp = false;
 }
 
-void ChorusEffect::setCoefficients(float d, float a, float r, float de, float fb) {
+void ChorusEffect::setCoefficients(float d, float a, float r, float de, float fb, uint t) {
     delay = d * sample_rate;
     amount = a;
     rate = r;
     depth = de;
     feedback = fb;
+    t = std::max(1u, std::min(t, uint(MAX_TAPS)));
+    if (t != taps) {
+        taps = t;
+        ramp = false; // new taps start at their position
+    }
 
     lfo_inc = r / sample_rate;
 }
 
 void ChorusEffect::setSamplerate(float r) {
     sample_rate = r;
+    delay_line.setMax(maxDelay(r));
+    clear();
+}
+
+void ChorusEffect::setSamplerate(float r, DelayMemory& memory) {
+    sample_rate = r;
+    delay_line.setMax(maxDelay(r), memory);
+    clear();
+}
+
+void ChorusEffect::updateTaps() {
+    // taps are spread evenly over the lfo cycle, right is modulated inversely
+    const uint lanes = 2 * taps;
+    for (uint t = 0; t < taps; t++) {
+        float phase = lfo_phase + float(t) / float(taps);
+        if (phase >= 1.0f) {
+            phase -= 1.0f;
+        }
+        float lfo_val = sin_.linear(phase);
+        float dl = std::max(1.0f, (1.0f + amount * lfo_val) * delay);
+        float dr = std::max(1.0f, (1.0f - amount * lfo_val) * delay);
+        lane_step[2 * t] = dl;
+        lane_step[2 * t + 1] = dr;
+    }
+    if (ramp) {
+        for (uint j = 0; j < lanes; j++) {
+            lane_step[j] = (lane_step[j] - lane_delay[j]) / float(CONTROL);
+        }
+    } else {
+        for (uint j = 0; j < lanes; j++) {
+            lane_delay[j] = lane_step[j];
+            lane_step[j] = 0.0f;
+        }
+        ramp = true;
+    }
+
+    lfo_phase += CONTROL * lfo_inc;
+    if (lfo_phase >= 1.0f) {
+        lfo_phase -= 1.0f;
+    }
 }
 
 void ChorusEffect::process(float* left, float* right, int samples) {
+    const uint lanes = 2 * taps;
+    const float gain = 1.0f / float(taps);
     for (uint i = 0; i < samples; i++) {
-        // configure
-        lfo_phase += lfo_inc;
-        if (lfo_phase >= 1.0f) {
-            lfo_phase -= 1.0f;
+        if (counter == 0) {
+            updateTaps();
+            counter = CONTROL;
+        }
+        counter--;
+
+        delay_line.tick(left[i] + feedback * last_l, right[i] + feedback * last_r);
+        for (uint j = 0; j < lanes; j++) {
+            lane_delay[j] += lane_step[j];
         }
-        float lfo_val = sin_.linear(lfo_phase);
-        float dl = (1.0 + amount * lfo_val) * delay;
-        float dr = (1.0 - amount * lfo_val) * delay;
-
-        // process
-        delay_l.setDelay(dl);
-        delay_r.setDelay(dr);
-        last_l = delay_l.process(left[i] + feedback * last_l);
-        last_r = delay_r.process(right[i] + feedback * last_r);
+        delay_line.read(lane_delay, lane_out, lanes);
+
+        float wet_l = 0.0f, wet_r = 0.0f;
+        for (uint j = 0; j < lanes; j += 2) {
+            wet_l += lane_out[j];
+            wet_r += lane_out[j + 1];
+        }
+        last_l = gain * wet_l;
+        last_r = gain * wet_r;
         left[i] += depth * last_l;
         right[i] += depth * last_r;
     }
@@ -82,48 +165,73 @@ float AllpassDelay::process(float a1, float in) {
 void PhaserEffect::clear() {
     last_l = last_r = 0.0;
     lfo_phase = 0.0;
+    counter = 0;
+    ramp = false;
 
-    for (uint i = 0; i < 8; i++) {
-        filters_l[i].clear();
-        filters_r[i].clear();
+    for (uint i = 0; i < MAX_STAGES; i++) {
+        zm1[i][0] = zm1[i][1] = 0.0f;
     }
 }
 
-void PhaserEffect::setCoefficients(float min_fr, float max_fr, float r, float d, float fb) {
+void PhaserEffect::setCoefficients(float min_fr, float max_fr, float r, float d, float fb, uint st) {
     min_d = 2.0 * min_fr / sample_rate;
     max_d = 2.0 * max_fr / sample_rate;
     delta_d = max_d - min_d;
     rate = r;
     depth = d;
     feedback = fb;
+    stages = std::max(1u, std::min(st, uint(MAX_STAGES)));
 
     lfo_inc = r / sample_rate;
 }
 
 void PhaserEffect::setSamplerate(float r) {
     sample_rate = r;
+    clear();
+}
+
+void PhaserEffect::updateCoefficients() {
+    // coefficients at the end of the tick, left and right sweep inversely
+    lfo_phase += CONTROL * lfo_inc;
+    if (lfo_phase >= 1.0f) {
+        lfo_phase -= 1.0f;
+    }
+    float lfo_val = 0.5 * (sin_.linear(lfo_phase) + 1);
+    float d[2] = {min_d + lfo_val * delta_d, max_d - lfo_val * delta_d};
+    for (uint c = 0; c < 2; c++) {
+        float target = (1.0 - d[c]) / (1.0 + d[c]);
+        if (ramp) {
+            a1_step[c] = (target - a1[c]) / float(CONTROL);
+        } else {
+            a1[c] = target;
+            a1_step[c] = 0.0f;
+        }
+    }
+    ramp = true;
 }
 
 void PhaserEffect::process(float* left, float* right, int samples) {
     for (uint i = 0; i < samples; i++) {
-        // configure
-        lfo_phase += lfo_inc;
-        if (lfo_phase >= 1.0f) {
-            lfo_phase -= 1.0f;
+        if (counter == 0) {
+            updateCoefficients();
+            counter = CONTROL;
         }
-        float lfo_val = 0.5 * (sin_.linear(lfo_phase) + 1);
-        float dl = min_d + lfo_val * delta_d;
-        float dr = max_d - lfo_val * delta_d;
-
-        // process
-        last_l = left[i] + feedback * last_l;
-        last_r = right[i] + feedback * last_r;
-        float a1l = (1.0 - dl) / (1.0 + dl);
-        float a1r = (1.0 - dr) / (1.0 + dr);
-        for (uint j = 0; j < 8; j++) {
-            last_l = filters_l[j].process(a1l, last_l);
-            last_r = filters_r[j].process(a1r, last_r);
+        counter--;
+        a1[0] += a1_step[0];
+        a1[1] += a1_step[1];
+
+        // allpass stages, left and right as a pair
+        const float a[2] = {a1[0], a1[1]};
+        float x[2] = {left[i] + feedback * last_l, right[i] + feedback * last_r};
+        for (uint j = 0; j < stages; j++) {
+            for (uint c = 0; c < 2; c++) {
+                float y = x[c] * -a[c] + zm1[j][c];
+                zm1[j][c] = y * a[c] + x[c];
+                x[c] = y;
+            }
         }
+        last_l = x[0];
+        last_r = x[1];
         left[i] += depth * last_l;
         right[i] += depth * last_r;
     }
@@ -139,11 +247,21 @@ void DelayEffect::clear() {
     filter_2l.clear();
     filter_1r.clear();
     filter_2r.clear();
+    fade[0] = fade[1] = 0;
+    snap = true;
 }
 
 void DelayEffect::setCoefficients(float bpm, float di_l, float di_r, float de, float fb, float pp, float lc, float hc) {
-    delay_l.setDelay(sample_rate / (bpm / 60 / di_l));
-    delay_r.setDelay(sample_rate / (bpm / 60 / di_r));
+    uint max = delay_l.getLength();
+    target[0] = std::max(1u, std::min(uint(sample_rate / (bpm / 60 / di_l)), max));
+    target[1] = std::max(1u, std::min(uint(sample_rate / (bpm / 60 / di_r)), max));
+    if (snap) {
+        // no fade from an empty line
+        for (uint c = 0; c < 2; c++) {
+            time[c] = previous[c] = target[c];
+        }
+        snap = false;
+    }
     depth = de;
     feedback = fb;
     direct = 1.0 - pp;
@@ -157,22 +275,77 @@ void DelayEffect::setCoefficients(float bpm, float di_l, float di_r, float de, f
 
 void DelayEffect::setSamplerate(float r) {
     sample_rate = r;
-    delay_l.setMax(2.0 * r); // for 30bpm
-    delay_r.setMax(2.0 * r); // for 30bpm
+    delay_l.setMax(maxDelay(r));
+    delay_r.setMax(maxDelay(r));
+    clear();
+}
+
+void DelayEffect::setSamplerate(float r, DelayMemory& memory) {
+    sample_rate = r;
+    delay_l.setMax(maxDelay(r), memory);
+    delay_r.setMax(maxDelay(r), memory);
+    clear();
 }
 
 void DelayEffect::process(float* left, float* right, int samples) {
-    for (uint i = 0; i < samples; i++) {
-        float filtered_l = filter_2l.process(filter_1l.process(direct * last_l + pingpong * last_r));
-        float filtered_r = filter_2r.process(filter_1r.process(direct * last_r + pingpong * last_l));
-        last_l = delay_l.process(left[i] + feedback * filtered_l);
-        last_r = delay_r.process(right[i] + feedback * filtered_r);
-        left[i] += depth * last_l;
-        right[i] += depth * last_r;
+    Delay* lines[2] = {&delay_l, &delay_r};
+    OnePole* lowcuts[2] = {&filter_1l, &filter_1r};
+    OnePole* highcuts[2] = {&filter_2l, &filter_2r};
+    float* io[2] = {left, right};
+
+    uint i = 0;
+    while (i < samples) {
+        // start pending fades, chunks don't reach into unwritten samples
+        uint n = std::min(uint(samples) - i, uint(CHUNK));
+        for (uint c = 0; c < 2; c++) {
+            if (fade[c] == 0 && target[c] != time[c]) {
+                previous[c] = time[c];
+                time[c] = target[c];
+                fade[c] = FADE;
+            }
+            n = std::min(n, std::min(time[c], previous[c]));
+        }
+
+        // read
+        for (uint c = 0; c < 2; c++) {
+            lines[c]->read(wet[c], time[c], n);
+            if (fade[c] > 0) {
+                lines[c]->read(old[c], previous[c], n);
+                for (uint j = 0; j < n; j++) {
+                    float g = fade[c] > j ? float(fade[c] - j) / float(FADE) : 0.0f;
+                    wet[c][j] += g * (old[c][j] - wet[c][j]);
+                }
+                fade[c] = fade[c] > n ? fade[c] - n : 0;
+            }
+        }
+
+        // feedback of the previous output, filtered
+        feed[0][0] = direct * last_l + pingpong * last_r;
+        feed[1][0] = direct * last_r + pingpong * last_l;
+        for (uint j = 1; j < n; j++) {
+            feed[0][j] = direct * wet[0][j - 1] + pingpong * wet[1][j - 1];
+            feed[1][j] = direct * wet[1][j - 1] + pingpong * wet[0][j - 1];
+        }
+        last_l = wet[0][n - 1];
+        last_r = wet[1][n - 1];
+
+        // write back and mix
+        for (uint c = 0; c < 2; c++) {
+            lowcuts[c]->process(feed[c], feed[c], n);
+            highcuts[c]->process(feed[c], feed[c], n);
+            float* x = io[c] + i;
+            for (uint j = 0; j < n; j++) {
+                feed[c][j] = x[j] + feedback * feed[c][j];
+            }
+            lines[c]->write(feed[c], n);
+            for (uint j = 0; j < n; j++) {
+                x[j] += depth * wet[c][j];
+            }
+        }
+        i += n;
     }
 }
 
-
 // ReverbEffect
 // Csound orchestra version coded by Sean Costello, October 1999
 // C implementation (C) 2005 Istvan Varga
@@ -193,20 +366,29 @@ static const double reverbParams[8][4] = {
 };
 
 ReverbEffect::ReverbEffect() {
-    for (uint i = 0; i < 8; i++) {
-        adelays[0].setDelay((i & 1) ? 0.6 : -0.6);
+    // XXX only the first allpass had its coefficient set, the others
+    // are plain unit delays, kept as such
+    for (uint j = 0; j < 8; j++) {
+        ap_a1[j] = 0.0f;
     }
+    ap_a1[0] = (1.0 - 0.6) / (1.0 + 0.6);
+
+    // TODO make the tone also configurable
+    lp_a1 = exp(-2.0 * M_PI * tone);
+    lp_b0 = 1.0 - lp_a1;
 }
 
 void ReverbEffect::clear() {
     erDelays[0].clear();
     erDelays[1].clear();
-
-    for (uint i = 0; i < 8; i++) {
-        adelays[i].clear();
-        delays[i].clear();
-        filters[i].clear();
-        lfos[i].clear();
+    delays.clear();
+
+    for (uint j = 0; j < 8; j++) {
+        ap_zm1[j] = 0.0f;
+        lp_last[j] = 0.0f;
+        phase[j] = 0.0f;
+        delay[j] = sample_rate * reverbParams[j][0];
+        noise[j] = uint(reverbParams[j][3]);
     }
 
     for (uint i = 0; i < 2; i++) {
@@ -218,15 +400,19 @@ void ReverbEffect::clear() {
 void ReverbEffect::setSamplerate(float r) {
     sample_rate = r;
 
-    erDelays[0].setMax(0.12 * r);
-    erDelays[1].setMax(0.12 * r);
+    erDelays[0].setMax(maxPreDelay(r));
+    erDelays[1].setMax(maxPreDelay(r));
+    delays.setMax(maxDelay(r));
+    clear();
+}
 
-    for (uint i = 0; i < 8; i++) {
-        delays[i].setMax(8192);
-        lfos[i].setSamplerate(r);
-        lfos[i].setType(0); // sine
-        lfos[i].setFreq(reverbParams[i][2]);
-    }
+void ReverbEffect::setSamplerate(float r, DelayMemory& memory) {
+    sample_rate = r;
+
+    erDelays[0].setMax(maxPreDelay(r), memory);
+    erDelays[1].setMax(maxPreDelay(r), memory);
+    delays.setMax(maxDelay(r), memory);
+    clear();
 }
 
 void ReverbEffect::setCoefficients(float _pre, float _decay, float _lowCut, float _highCut, float _depth) {
@@ -235,13 +421,8 @@ void ReverbEffect::setCoefficients(float _pre, float _decay, float _lowCut, floa
 
     gain = sqrt(_decay);
     pitchmod = 0.6;
-    tone = 0.9; // TODO make this also configurable
     depth = _depth;
 
-    for (uint i = 0; i < 8; i++) {
-        filters[i].setLowpass(tone);
-    }
-
     _lowCut /= sample_rate;
     lowCut[0].setHighpass(_lowCut, 0);
     lowCut[1].setHighpass(_lowCut, 0);
@@ -252,45 +433,181 @@ void ReverbEffect::setCoefficients(float _pre, float _decay, float _lowCut, floa
 }
 
 void ReverbEffect::process(float* left, float* right, int samples) {
+    for (uint start = 0; start < samples; start += CHUNK) {
+        uint n = std::min(uint(samples) - start, uint(CHUNK));
+        process_chunk(left + start, right + start, n);
+    }
+}
+
+void ReverbEffect::process_chunk(float* left, float* right, int samples) {
+    // pre delay
     for (uint i = 0; i < samples; i++) {
-        // pre delay
-        float pleft = erDelays[0].process(left[i]);
-        float pright = erDelays[1].process(right[i]);
-
-        // pre filters
-        float fleft = highCut[0].process(pleft);
-        float fright = highCut[1].process(pright);
-        fleft = lowCut[0].process(fleft);
-        fright = lowCut[1].process(fright);
-
-        // calculate junction pressure
-        float apj = 0.0;
-        for (uint j = 0; j < 8; j++) apj += filters[j].getLast();
-        apj *= 0.25;
-
-        // FDN delay lines
-        float l = fleft + apj;
-        float r = fright + apj;
+        pre[0][i] = erDelays[0].process(left[i]);
+        pre[1][i] = erDelays[1].process(right[i]);
+    }
+
+    // pre filters
+    for (uint c = 0; c < 2; c++) {
+        highCut[c].process(pre[c], pre[c], samples);
+        lowCut[c].process(pre[c], pre[c], samples);
+    }
+
+    const float dry = 1.0f - depth;
+    const float lp_gain = lp_b0 * gain;
+
+    for (uint start = 0; start < samples; start += MOD_BLOCK) {
+        uint n = std::min(uint(samples) - start, uint(MOD_BLOCK));
+
+        // delay modulation, targets at control rate and ramped per sample
         for (uint j = 0; j < 8; j++) {
-            float d = reverbParams[j][0] + lfos[j].tick() * pitchmod * reverbParams[j][1];
-            delays[j].setDelay(sample_rate * d);
-            // send input signal and feedback to delay line
-            float fb = filters[j].getLast();
-            float noise = (2.0f * rand() / (RAND_MAX + 1.0f) - 1.0f);
-            fb += fb * 0.001 * noise;
-            float aout = adelays[j].process((j & 1 ? r : l) - fb);
-            filters[j].process(gain * delays[j].process(aout));
+            phase[j] += float(n) * reverbParams[j][2] / sample_rate;
+            if (phase[j] >= 1.0f) {
+                phase[j] -= 1.0f;
+            }
+            float d = reverbParams[j][0] + sin_.linear(phase[j]) * pitchmod * reverbParams[j][1];
+            delay_step[j] = (sample_rate * d - delay[j]) / float(n);
+        }
+
+        for (uint i = start; i < start + n; i++) {
+            // calculate junction pressure
+            float apj = 0.0f;
+            for (uint j = 0; j < 8; j++) apj += lp_last[j];
+            apj *= 0.25f;
+
+            // FDN delay lines, all lanes at once
+            const float l = pre[0][i] + apj;
+            const float r = pre[1][i] + apj;
+            for (uint j = 0; j < 8; j++) {
+                // feedback with a little noise, per lane LCG
+                noise[j] = noise[j] * 1664525u + 1013904223u;
+                float nz = float(int(noise[j])) * (1.0f / 2147483648.0f);
+                float fb = lp_last[j] + 0.001f * lp_last[j] * nz;
+                float x = ((j & 1) ? r : l) - fb;
+                // allpass
+                float y = x * -ap_a1[j] + ap_zm1[j];
+                ap_zm1[j] = y * ap_a1[j] + x;
+                lane_in[j] = y;
+                delay[j] += delay_step[j];
+            }
+            delays.process(lane_in, delay, lane_out);
+            for (uint j = 0; j < 8; j++) {
+                lp_last[j] = lp_gain * lane_out[j] - lp_a1 * lp_last[j];
+            }
+
+            // mix
+            float lout = lp_last[0] + lp_last[2] + lp_last[4] + lp_last[6];
+            float rout = lp_last[1] + lp_last[3] + lp_last[5] + lp_last[7];
+            left[i] = dry * left[i] + depth * lout;
+            right[i] = dry * right[i] + depth * rout;
         }
+    }
+}
+
+// Limiter
+
+void Limiter::clear() {
+    std::fill(&line[0][0], &line[0][0] + 2 * LINE, 0.0f);
+    write = pos = block = 0;
+    peak = 0.0f;
+    head = tail = 0;
+    std::fill(window_gain, window_gain + MAX_WINDOW, 1.0f);
+    window_sum = window;
+    env = gain = 1.0f;
+    gain_step = 0.0f;
+}
 
-        // mix
-        float lout = filters[0].getLast() + filters[2].getLast()
-                   + filters[4].getLast() + filters[6].getLast();
-        float rout = filters[1].getLast() + filters[3].getLast()
-                   + filters[5].getLast() + filters[7].getLast();
+void Limiter::setCoefficients(float ceiling_db) {
+    ceiling = powf(10.0f, 0.05f * ceiling_db);
+}
+
+void Limiter::setSamplerate(float r) {
+    sample_rate = r;
+    // about 1.5ms lookahead and 50ms release
+    window = std::max(1u, std::min(uint(0.0015f * r / CONTROL + 0.5f), uint(MAX_WINDOW)));
+    release = 1.0f - expf(-float(CONTROL) / (0.05f * r));
+    clear();
+}
+
+void Limiter::updateGain() {
+    // gain needed for the block, pushed to the back of the deque
+    float needed = peak > ceiling ? ceiling / peak : 1.0f;
+    while (tail != head && queue_gain[(tail - 1) % QUEUE] >= needed) {
+        tail--;
+    }
+    queue_gain[tail % QUEUE] = needed;
+    queue_block[tail % QUEUE] = block;
+    tail++;
+    // blocks older than the window + 1 leave from the front
+    while (block - queue_block[head % QUEUE] > window) {
+        head++;
+    }
+    float min = queue_gain[head % QUEUE];
+
+    // average of the minima over the window, then a slower release
+    uint w = block % window;
+    window_sum += min - window_gain[w];
+    window_gain[w] = min;
+    float avg = std::min(float(window_sum / window), 1.0f);
+    env = avg < env ? avg : env + (avg - env) * release;
+
+    gain_step = (env - gain) * (1.0f / CONTROL);
+    peak = 0.0f;
+    block++;
+}
 
-        float dry = 1.0f - depth;
-        left[i] = dry * left[i] + depth * lout;
-        right[i] = dry * right[i] + depth * rout;
+void Limiter::process(float* left, float* right, int samples) {
+    float* io[2] = {left, right};
+    const uint delay = latency();
+    uint i = 0;
+    while (i < samples) {
+        uint n = std::min(uint(samples) - i, CONTROL - pos);
+        const uint read = (write + LINE - delay) % LINE;
+        float p = peak;
+        if (read + n <= LINE && write >= 3 && write + n <= LINE) {
+            for (uint c = 0; c < 2; c++) {
+                float* s = io[c] + i;
+                const float* r = line[c] + read;
+                float* w = line[c] + write;
+                // delayed output with the gain ramped towards the block gain
+                for (uint j = 0; j < n; j++) {
+                    float in = s[j];
+                    s[j] = (gain + (j + 1) * gain_step) * r[j];
+                    w[j] = in;
+                }
+                // sample and midpoint peaks, the midpoints are interpolated
+                // from four samples
+                const float* x = w - 3;
+                for (uint j = 0; j < n; j++) {
+                    float mid = 0.5625f * (x[j + 1] + x[j + 2]) - 0.0625f * (x[j] + x[j + 3]);
+                    p = std::max(p, std::max(fabsf(x[j + 3]), fabsf(mid)));
+                }
+            }
+        } else {
+            // same around the end of the line
+            for (uint c = 0; c < 2; c++) {
+                float* s = io[c] + i;
+                float* l = line[c];
+                for (uint j = 0; j < n; j++) {
+                    float in = s[j];
+                    s[j] = (gain + (j + 1) * gain_step) * l[(read + j) % LINE];
+                    l[(write + j) % LINE] = in;
+                    float x0 = l[(write + j - 3) % LINE], x1 = l[(write + j - 2) % LINE];
+                    float x2 = l[(write + j - 1) % LINE];
+                    float mid = 0.5625f * (x1 + x2) - 0.0625f * (x0 + in);
+                    p = std::max(p, std::max(fabsf(in), fabsf(mid)));
+                }
+            }
+        }
+        peak = p;
+        gain += n * gain_step;
+        write = (write + n) % LINE;
+        pos += n;
+        i += n;
+        if (pos == CONTROL) {
+            gain = env;
+            updateGain();
+            pos = 0;
+        }
     }
 }
 
@@ -8,6 +8,7 @@
 #define DSP_EFFECTS_H
 
 #include <math.h>
+#include <algorithm>
 #include "types.h"
 #include "delay.h"
 #include "filter.h"
@@ -15,29 +16,67 @@
 
 namespace dsp {
 
+/** true if the RMS of both channels is below the silence threshold (about -100dB) */
+bool is_silent(const float* left, const float* right, int samples);
+
 class Effect {
   public:
     virtual void clear() = 0;
     virtual void process(float* left, float* right, int samples) = 0;
     virtual void setSamplerate(float r) = 0;
+
+    /**
+     * processes unless the effect sleeps. It falls asleep when input and
+     * output have been silent for longer than its tail and wakes up on the
+     * first non-silent input. Returns false when asleep, the buffers are
+     * then left untouched.
+     */
+    bool run(float* left, float* right, int samples);
+    bool asleep() const { return sleeping; }
+
+  protected:
+    /** samples after which silent output means the internal state has decayed */
+    virtual uint tailLength() = 0;
+
+  private:
+    uint silent = 0;
+    bool sleeping = false;
 };
 
+// effects with delay lines take them either from their own heap memory via
+// setSamplerate(r) or from a preallocated arena via setSamplerate(r, memory),
+// memorySize(r) is the arena size they need
+
 // Chorus
 // TODO - lp after delay or in feedback
 
-class ChorusEffect : Effect {
-    DelayL delay_l, delay_r;
+class ChorusEffect : public Effect {
+    static const uint MAX_TAPS = 4;
+    static const uint LANES = 2 * MAX_TAPS;
+    static const uint CONTROL = 16;
+    static uint maxDelay(float r) { return 0.1 * r + 2; } // 2 * max delay
+
+    // lanes are interleaved left/right pairs of taps
+    MTapDelay delay_line;
+    float lane_delay[LANES], lane_step[LANES], lane_out[LANES];
+    uint taps = 1, counter = 0;
+    bool ramp = false;
     float lfo_phase = 0, lfo_inc;
     float delay, amount, rate, depth, feedback;
     float last_l = 0, last_r = 0;
     float sample_rate;
 
+    void updateTaps();
+    uint tailLength() { return maxDelay(sample_rate); }
+
   public:
     ChorusEffect() {}
     void clear();
     void process(float* left, float* right, int samples);
-    void setCoefficients(float d, float a, float r, float de, float fb);
+    void setCoefficients(float d, float a, float r, float de, float fb, uint t = 1);
     void setSamplerate(float r);
+    void setSamplerate(float r, DelayMemory& memory);
+    static uint memorySize(float r) { return 2 * next_pow2(maxDelay(r)); }
 };
 
 // Phaser
@@ -52,25 +91,51 @@ class AllpassDelay {
     void setDelay(float d);
 };
 
-class PhaserEffect : Effect {
-    AllpassDelay filters_l[8];
-    AllpassDelay filters_r[8];
+/**
+ * phaser with 4, 8 or 12 allpass stages per channel
+ *
+ * The left and right chains are packed into pairs and run together stage
+ * by stage. Allpass coefficients are computed per control tick and ramped.
+ */
+class PhaserEffect : public Effect {
+    static const uint MAX_STAGES = 12;
+    static const uint CONTROL = 16;
+
+    float zm1[MAX_STAGES][2];
+    float a1[2], a1_step[2];
+    uint stages = 8, counter = 0;
+    bool ramp = false;
     float lfo_phase = 0, lfo_inc;
     float min_d, max_d, delta_d, rate, depth, feedback;
     float last_l = 0, last_r = 0;
     float sample_rate;
 
+    void updateCoefficients();
+    uint tailLength() { return 0.05 * sample_rate; }
+
   public:
     PhaserEffect() {}
     void clear();
     void process(float* left, float* right, int samples);
-    void setCoefficients(float min_fr, float max_fr, float r, float d, float fb);
+    void setCoefficients(float min_fr, float max_fr, float r, float d, float fb, uint st = 8);
     void setSamplerate(float r);
 };
 
 // Delay
 
-class DelayEffect : Effect {
+/**
+ * tempo synced stereo delay, processed in blocks
+ *
+ * The delay is always longer than the processed chunk, so the delayed
+ * samples are read as contiguous blocks and the feedback filters run over
+ * them. Delay time changes are crossfaded between the old and the new read
+ * position.
+ */
+class DelayEffect : public Effect {
+    static const uint CHUNK = 64;
+    static const uint FADE = 1024;
+    static uint maxDelay(float r) { return 2.0 * r + 1; } // for 30bpm
+
     Delay delay_l, delay_r;
     OnePole filter_1l, filter_2l, filter_1r, filter_2r;
     float depth, feedback, direct, pingpong;
@@ -78,12 +143,22 @@ class DelayEffect : Effect {
     float last_l = 0, last_r = 0;
     float sample_rate;
 
+    // delay times in samples, previous is faded out over fade samples
+    uint time[2] = {1, 1}, target[2] = {1, 1}, previous[2] = {1, 1};
+    uint fade[2] = {0, 0};
+    bool snap = true;
+    float wet[2][CHUNK], old[2][CHUNK], feed[2][CHUNK];
+
+    uint tailLength() { return std::max(time[0], time[1]) + std::max(previous[0], previous[1]) + FADE; }
+
   public:
     DelayEffect() {}
     void clear();
     void process(float* left, float* right, int samples);
     void setCoefficients(float b, float di_l, float di_r, float de, float fb, float pp, float lc, float hc);
     void setSamplerate(float r);
+    void setSamplerate(float r, DelayMemory& memory);
+    static uint memorySize(float r) { return 2 * next_pow2(maxDelay(r)); }
 };
 
 // Reverb (FDN based)
@@ -91,22 +166,29 @@ class DelayEffect : Effect {
 // Csound orchestra version coded by Sean Costello, October 1999
 // C implementation (C) 2005 Istvan Varga
 
-class ReverbEffect : Effect {
+class ReverbEffect : public Effect {
     static const uint ER_DELAYS = 12;
+    static const uint CHUNK = 64;
+    static const uint MOD_BLOCK = 16; // delay modulation update interval
+    static uint maxPreDelay(float r) { return 0.1 * r + 1; }
+    static uint maxDelay(float r) { return 0.1 * r; } // longest line plus modulation
 
     // early reflections
     DelayL erDelays[2]; // stereo delay
 
-    BiQuadDF2 lowCut[2];
-    BiQuadDF2 highCut[2];
+    BiQuadBlock lowCut[2];
+    BiQuadBlock highCut[2];
+    float pre[2][CHUNK];
 
-    // late reverb
-    AllpassDelay adelays[8];
-    DelayL delays[8];
-    OnePole filters[8];
-    LFO lfos[8];
+    // late reverb, one lane per delay line
+    DelayL8 delays;
+    float lane_in[8], lane_out[8];
+    float ap_a1[8], ap_zm1[8];                // allpass
+    float lp_b0, lp_a1, lp_last[8];           // one pole lowpass
+    float phase[8], delay[8], delay_step[8];  // delay modulation
+    uint noise[8];
     float sample_rate, samples_per_meter;
-    float gain = 0.9, pitchmod = 1.0, tone = 5000.0, depth = 0.0;
+    float gain = 0.9, pitchmod = 1.0, tone = 0.9, depth = 0.0;
 
   public:
     ReverbEffect();
@@ -114,6 +196,62 @@ class ReverbEffect : Effect {
     void setCoefficients(float _pre, float _decay, float _lowCut, float _highCut, float _depth);
     void process(float* left, float* right, int samples);
     void setSamplerate(float r);
+    void setSamplerate(float r, DelayMemory& memory);
+    static uint memorySize(float r) {
+        return 2 * next_pow2(maxPreDelay(r)) + DelayL8::LANES * next_pow2(maxDelay(r));
+    }
+
+  private:
+    void process_chunk(float* left, float* right, int samples);
+    uint tailLength() { return maxPreDelay(sample_rate) + maxDelay(sample_rate); }
+};
+
+// Limiter
+
+/**
+ * lookahead brickwall limiter
+ *
+ * Peaks, including the inter-sample peaks estimated at the midpoints, are
+ * detected per control block. The gain of a block is the minimum of the
+ * gains needed over the lookahead window, kept in a monotonic deque, and
+ * averaged over the window for a smooth attack. The output is delayed by
+ * latency() samples, so the gain has reached its target when a peak
+ * arrives.
+ */
+class Limiter : public Effect {
+    static const uint CONTROL = 32;
+    static const uint MAX_WINDOW = 16;   // lookahead in control blocks
+    static const uint QUEUE = 32;        // deque capacity, > MAX_WINDOW
+    static const uint LINE = 1024;       // delay line, > (MAX_WINDOW + 1) * CONTROL
+
+    float line[2][LINE];
+    uint write = 0, pos = 0, block = 0;
+    float peak = 0.0f;
+
+    // sliding minimum of the block gains
+    float queue_gain[QUEUE];
+    uint queue_block[QUEUE];
+    uint head = 0, tail = 0;
+
+    // moving average over the window, release and the ramped output gain
+    float window_gain[MAX_WINDOW];
+    double window_sum;
+    float env, gain, gain_step;
+
+    uint window = 4;
+    float ceiling = 1.0f, release;
+    float sample_rate;
+
+    void updateGain();
+    uint tailLength() { return latency(); }
+
+  public:
+    Limiter() {}
+    void clear();
+    void process(float* left, float* right, int samples);
+    void setCoefficients(float ceiling_db);
+    void setSamplerate(float r);
+    uint latency() const { return (window + 1) * CONTROL; }
 };
 
 }
@@ -35,6 +35,17 @@ void AHDSR::setAHDSR(float _a, float _h, float _d, float _s, float _r) {
     releaseRate = 1.0f / _r;
 }
 
+void AHDSR::setSettings(const AHDSR& e) {
+    preDelaySamples = e.preDelaySamples;
+    attackRate = e.attackRate;
+    holdSamples = e.holdSamples;
+    decayRate = e.decayRate;
+    sustain = e.sustain;
+    releaseRate = e.releaseRate;
+    a = e.a;
+    retrigger = e.retrigger;
+}
+
 float AHDSR::innerTick(int samples) {
     while (true) {
         if (state_ == PRE) {      // pre-delay
@@ -128,4 +139,11 @@ float AHDSR::tick(int samples) {
     return offset + scale * envCurve(last);
 }
 
+void AHDSR::process(float* output, int samples) {
+    for (int i = 0; i < samples; i++) {
+        innerTick(1);
+        output[i] = offset + scale * envCurve(last);
+    }
+}
+
 }
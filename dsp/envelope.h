@@ -25,9 +25,13 @@ class AHDSR {
     void setPredelay(float _pre) { preDelaySamples = _pre; }
     void setAHDSR(float _a, float _h, float _d, float _s, float _r);
     void setCurve(float t) { a = 1.0f - 1.0f/t; }
+    /** takes the settings of the given envelope, keeps the state */
+    void setSettings(const AHDSR& e);
     int state() { return state_; }
+    bool sustaining() const { return state_ == S; }
     float tick(int samples);
     float tick();
+    void process(float* output, int samples);
 
   private:
     float envCurve(float x);
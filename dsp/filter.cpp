@@ -11,10 +11,40 @@
 #include "tables.h"
 #include "types.h"
 
-#define TANH(x) tanh_.linear(x)
-
 namespace dsp {
 
+// rational tanh approximation, reaches +-1 at +-3, branch free
+static inline float fast_tanh(float x) {
+    x = std::max(-3.0f, std::min(3.0f, x));
+    float x2 = x * x;
+    return x * (27.0f + x2) / (27.0f + 9.0f * x2);
+}
+
+static inline float drive_gain(float d) {
+    return 1.0f + 8.0f * d;
+}
+
+// share of the saturated signal, faded in over the lowest amounts so that
+// the gain is continuous with the undriven filter at 0
+static inline float drive_wet(float d) {
+    return std::min(10.0f * d, 1.0f);
+}
+
+static inline float drive_shape(float x, float gain, float norm, float wet) {
+    return x + wet * (norm * fast_tanh(gain * x) - x);
+}
+
+// length of the chunks in which a rate switch is crossfaded
+static const int FADE_CHUNK = 64;
+
+// fades from a to b over a block of length, starting at pos
+static inline void crossfade(const float* a, float* b, int pos, int samples, int length) {
+    const float s = 1.0f / float(length);
+    for (int i = 0; i < samples; i++) {
+        b[i] = a[i] + float(pos + i + 1) * s * (b[i] - a[i]);
+    }
+}
+
 // DCBlocker
 
 void DCBlocker::clear() {
@@ -71,10 +101,12 @@ float OnePole::process(float input) {
 }
 
 void OnePole::process(float* input, float* output, int samples) {
+    float last = last_;
     for (uint i = 0; i < samples; i++) {
-        last_ = b0_ * input[i] - a1_ * last_;
-        output[i] = last_;
+        last = b0_ * input[i] - a1_ * last;
+        output[i] = last;
     }
+    last_ = last;
 }
 
 // OneZero
@@ -254,33 +286,17 @@ void BiQuadDF2::setCoefficients(float b0, float b1, float b2, float a1, float a2
 }
 
 void BiQuadDF2::setLowpass(float w, float res) {
-    float r = std::max(0.001, 2.0 * (1.0 - res));
-    float k = tan(w * M_PI);
-    float k2 = k * k;
-    float rk = r * k;
-    float bh = 1.0 + rk + k2;
-
-    float b0 = k2 / bh;
-    float b1 = b0 * 2.0;
-    float b2 = b0;
-    float a1 = (2.0 * (k2 - 1.0)) / bh;
-    float a2 = (1.0 - rk + k2) / bh;
-    setCoefficients(b0, b1, b2, a1, a2);
+    float c[5];
+    biquad_.linear(w, res, c);
+    float lp = c[biquadtable::LP];
+    setCoefficients(lp, 2.0f * lp, lp, c[biquadtable::B1], c[biquadtable::B2]);
 }
 
 void BiQuadDF2::setHighpass(float w, float res) {
-    float r = std::max(0.001, 2.0 * (1.0 - res));
-    float k = tan(w * M_PI);
-    float k2 = k * k;
-    float rk = r * k;
-    float bh = 1.0 + rk + k2;
-
-    float b0 = 1.0 / bh;
-    float b1 = -2.0 / bh;
-    float b2 = b0;
-    float a1 = (2.0 * (k2 - 1.0)) / bh;
-    float a2 = (1.0 - rk + k2) / bh;
-    setCoefficients(b0, b1, b2, a1, a2);
+    float c[5];
+    biquad_.linear(w, res, c);
+    float hp = c[biquadtable::HP];
+    setCoefficients(hp, -2.0f * hp, hp, c[biquadtable::B1], c[biquadtable::B2]);
 }
 
 float BiQuadDF2::process(float x) {
@@ -300,6 +316,119 @@ void BiQuadDF2::process(float* input, float* output, int samples) {
     }
 }
 
+// BiQuadBlock
+
+void BiQuadBlock::clear() {
+    z1_ = z2_ = 0.0f;
+}
+
+void BiQuadBlock::setCoefficients(float b0, float b1, float b2, float a1, float a2) {
+    b0_ = b0;
+    b1_ = b1;
+    b2_ = b2;
+    a1_ = a1;
+    a2_ = a2;
+
+    // derive the block matrices from the responses of the DF2 recursion
+    // to the unit states and to unit impulses at each block position
+    for (uint j = 0; j < 6; j++) {
+        double z1 = j == 0 ? 1.0 : 0.0;
+        double z2 = j == 1 ? 1.0 : 0.0;
+        for (uint k = 0; k < 4; k++) {
+            double x = (j == k + 2) ? 1.0 : 0.0;
+            double y = b0 * x + z1;
+            z1 = z2 + b1 * x - a1 * y;
+            z2 = b2 * x - a2 * y;
+            if (j == 0) {
+                cz1_[k] = y;
+            } else if (j == 1) {
+                cz2_[k] = y;
+            } else {
+                cx_[j - 2][k] = y;
+            }
+        }
+        if (j == 0) {
+            az1_[0] = z1; az1_[1] = z2;
+        } else if (j == 1) {
+            az2_[0] = z1; az2_[1] = z2;
+        } else {
+            ax_[j - 2][0] = z1; ax_[j - 2][1] = z2;
+        }
+    }
+}
+
+void BiQuadBlock::setLowpass(float w, float res) {
+    float c[5];
+    biquad_.linear(w, res, c);
+    float lp = c[biquadtable::LP];
+    setCoefficients(lp, 2.0f * lp, lp, c[biquadtable::B1], c[biquadtable::B2]);
+}
+
+void BiQuadBlock::setHighpass(float w, float res) {
+    float c[5];
+    biquad_.linear(w, res, c);
+    float hp = c[biquadtable::HP];
+    setCoefficients(hp, -2.0f * hp, hp, c[biquadtable::B1], c[biquadtable::B2]);
+}
+
+void BiQuadBlock::process(float* input, float* output, int samples) {
+    float z1 = z1_, z2 = z2_;
+    int i = 0;
+    for (; i + 4 <= samples; i += 4) {
+        const float x0 = input[i], x1 = input[i + 1], x2 = input[i + 2], x3 = input[i + 3];
+        float y[4];
+        for (uint k = 0; k < 4; k++) {
+            y[k] = cz1_[k] * z1 + cz2_[k] * z2
+                 + cx_[0][k] * x0 + cx_[1][k] * x1 + cx_[2][k] * x2 + cx_[3][k] * x3;
+        }
+        const float n1 = az1_[0] * z1 + az2_[0] * z2
+                       + ax_[0][0] * x0 + ax_[1][0] * x1 + ax_[2][0] * x2 + ax_[3][0] * x3;
+        const float n2 = az1_[1] * z1 + az2_[1] * z2
+                       + ax_[0][1] * x0 + ax_[1][1] * x1 + ax_[2][1] * x2 + ax_[3][1] * x3;
+        z1 = n1;
+        z2 = n2;
+        for (uint k = 0; k < 4; k++) {
+            output[i + k] = y[k];
+        }
+    }
+    // remainder
+    for (; i < samples; i++) {
+        float x = input[i];
+        float y = (b0_ * x) + z1;
+        z1 = z2 + (b1_ * x) - (a1_ * y);
+        z2 = (b2_ * x) - (a2_ * y);
+        output[i] = y;
+    }
+    z1_ = z1;
+    z2_ = z2;
+}
+
+// Drive
+
+void Drive::setAmount(float d) {
+    amount = d;
+    gain = drive_gain(d);
+    norm = 1.0f / fast_tanh(gain);
+    wet = drive_wet(d);
+}
+
+void Drive::process(float* input, float* output, int samples) {
+    if (samples <= 0) {
+        return;
+    }
+    // backwards, so that input and output can be the same buffer
+    float next = input[samples - 1];
+    for (int i = samples - 1; i > 0; i--) {
+        float x = input[i];
+        float xh = 0.5f * (x + input[i - 1]);
+        output[i] = 0.5f * (drive_shape(xh, gain, norm, wet) + drive_shape(x, gain, norm, wet));
+    }
+    float x = input[0];
+    float xh = 0.5f * (x + last);
+    output[0] = 0.5f * (drive_shape(xh, gain, norm, wet) + drive_shape(x, gain, norm, wet));
+    last = next;
+}
+
 // AmSynth
 
 void AmSynthFilter::clear() {
@@ -307,73 +436,106 @@ void AmSynthFilter::clear() {
     d2 = 0.0;
     d3 = 0.0;
     d4 = 0.0;
+    snap_ = true;
+    drive_.clear();
 }
 
 void AmSynthFilter::setCoefficients(float f, float r) {
-    freq_ = std::min(f, float(sample_rate_ / 2.0) * 0.99f); // filter is unstable at PI
-    freq_ = std::max(freq_, 10.0f);
+    f = std::min(f, float(sample_rate_ / 2.0) * 0.99f); // filter is unstable at PI
+    f = std::max(f, 10.0f);
+    if (f == freq_ && r == res_ && type_ % 3 == coeff_type_) {
+        return;
+    }
+    freq_ = f;
     res_ = r;
-}
-
-void AmSynthFilter::process(float* input, float* output, int samples) {
-    const double w = (freq_ / sample_rate_); // cutoff freq [ 0 <= w <= 0.5 ]
-    const double r = std::max(0.001, 2.0 * (1.0 - res_)); // r is 1/Q (sqrt(2) for a butterworth response)
+    coeff_type_ = type_ % 3;
 
-    const double k = tan(w * M_PI);
-    const double k2 = k * k;
-    const double rk = r * k;
-    const double bh = 1.0 + rk + k2;
+    float c[5];
+    biquad_.linear(freq_ / sample_rate_, res_, c);
 
-    double a0, a1, a2, b1, b2;
-
-    switch (type_ % 3) {
+    switch (coeff_type_) {
         case 0: // low
-            a0 = k2 / bh;
-            a1 = a0 * 2.0;
-            a2 = a0;
-            b1 = (2.0 * (k2 - 1.0)) / bh;
-            b2 = (1.0 - rk + k2) / bh;
+            a0t_ = c[biquadtable::LP];
+            a1t_ = a0t_ * 2.0f;
+            a2t_ = a0t_;
             break;
         case 1: // high
-            a0 =  1.0 / bh;
-            a1 = -2.0 / bh;
-            a2 =  a0;
-            b1 = (2.0 * (k2 - 1.0)) / bh;
-            b2 = (1.0 - rk + k2) / bh;
+            a0t_ =  c[biquadtable::HP];
+            a1t_ = -2.0f * a0t_;
+            a2t_ =  a0t_;
             break;
         case 2: // band
-            a0 =  rk / bh;
-            a1 =  0.0;
-            a2 = -rk / bh;
-            b1 = (2.0 * (k2 - 1.0)) / bh;
-            b2 = (1.0 - rk + k2) / bh;
+            a0t_ =  c[biquadtable::BP];
+            a1t_ =  0.0f;
+            a2t_ = -a0t_;
             break;
     }
+    b1t_ = c[biquadtable::B1];
+    b2t_ = c[biquadtable::B2];
+    ramp_ = true;
+}
 
-    if (type_ < 3) {
-        for (int i = 0; i < samples; i++) {
-            float y, x = input[i];
+#define AMSYNTH_STAGE(x, y, d1, d2) \
+    y  =      (a0 * x) + d1; \
+    d1 = d2 + (a1 * x) - (b1 * y); \
+    d2 =      (a2 * x) - (b2 * y);
 
-            y  =      (a0 * x) + d1;
-            d1 = d2 + (a1 * x) - (b1 * y);
-            d2 =      (a2 * x) - (b2 * y);
+#define AMSYNTH_RAMP() \
+    a0 += a0s; a1 += a1s; a2 += a2s; \
+    b1 += b1s; b2 += b2s;
 
-            x = y;
-
-            y  =      (a0 * x) + d3;
-            d3 = d4 + (a1 * x) - (b1 * y);
-            d4 =      (a2 * x) - (b2 * y);
+void AmSynthFilter::process(float* input, float* output, int samples) {
+    if (drive_.active()) {
+        drive_.process(input, output, samples);
+        input = output;
+    }
 
+    if (ramp_ && snap_) {
+        a0_ = a0t_; a1_ = a1t_; a2_ = a2t_;
+        b1_ = b1t_; b2_ = b2t_;
+        ramp_ = false;
+    }
+    snap_ = false;
+
+    float a0 = a0_, a1 = a1_, a2 = a2_, b1 = b1_, b2 = b2_;
+
+    if (ramp_) {
+        // linear interpolation of the coefficients over the block
+        const float s = 1.0f / float(samples);
+        const float a0s = (a0t_ - a0) * s, a1s = (a1t_ - a1) * s, a2s = (a2t_ - a2) * s;
+        const float b1s = (b1t_ - b1) * s, b2s = (b2t_ - b2) * s;
+        if (type_ < 3) {
+            for (int i = 0; i < samples; i++) {
+                AMSYNTH_RAMP()
+                float y, x = input[i];
+                AMSYNTH_STAGE(x, y, d1, d2)
+                x = y;
+                AMSYNTH_STAGE(x, y, d3, d4)
+                output[i] = y;
+            }
+        } else {
+            for (int i = 0; i < samples; i++) {
+                AMSYNTH_RAMP()
+                float y, x = input[i];
+                AMSYNTH_STAGE(x, y, d1, d2)
+                output[i] = y;
+            }
+        }
+        a0_ = a0t_; a1_ = a1t_; a2_ = a2t_;
+        b1_ = b1t_; b2_ = b2t_;
+        ramp_ = false;
+    } else if (type_ < 3) {
+        for (int i = 0; i < samples; i++) {
+            float y, x = input[i];
+            AMSYNTH_STAGE(x, y, d1, d2)
+            x = y;
+            AMSYNTH_STAGE(x, y, d3, d4)
             output[i] = y;
         }
     } else {
         for (int i = 0; i < samples; i++) {
             float y, x = input[i];
-
-            y  =      (a0 * x) + d1;
-            d1 = d2 + (a1 * x) - (b1 * y);
-            d2 =      (a2 * x) - (b2 * y);
-
+            AMSYNTH_STAGE(x, y, d1, d2)
             output[i] = y;
         }
     }
@@ -385,11 +547,25 @@ void MoogFilter::clear() {
     f = 0; pc = 0; q = 0;
     bf0 = 0; bf1 = 0; bf2 = 0; bf3 = 0; bf4 = 0;
     t1 = 0; t2 = 0;
+    x1 = 0;
+}
+
+void MoogFilter::setDistortion(float d) {
+    drive = d;
+    gain = drive_gain(d);
+    norm = 1.0f / fast_tanh(gain);
+    wet = drive_wet(d);
 }
 
 void MoogFilter::setCoefficients(float f_, float r_) {
-    float frequency = f_ / (0.5 * sample_rate);
-    float resonance = r_;
+    fc = f_;
+    res = r_;
+    tune(drive > 0.0f ? 2.0f * sample_rate : sample_rate);
+}
+
+void MoogFilter::tune(float rate) {
+    float frequency = fc / (0.5 * rate);
+    float resonance = res;
 
     if (frequency < 0) frequency = 0;
     if (frequency > 0.6) frequency = 0.6;
@@ -400,23 +576,66 @@ void MoogFilter::setCoefficients(float f_, float r_) {
     q = resonance * (1.0f + 0.5f * q * (1.0f - q + 5.6f * q * q));
 }
 
-void MoogFilter::process(float* input, float* output, int samples) {
+#define MOOG_STAGES(in) \
+    t1 = bf1;  bf1 = (in + bf0) * pc - bf1 * f; \
+    t2 = bf2;  bf2 = (bf1 + t1) * pc - bf2 * f; \
+    t1 = bf3;  bf3 = (bf2 + t2) * pc - bf3 * f; \
+    bf4 = (bf3 + t1) * pc - bf4 * f; \
+    bf4 = bf4 - bf4 * bf4 * bf4 * 0.166667f;    /* clipping */ \
+    bf0 = in;
+
+void MoogFilter::run(float* input, float* output, int samples, bool driven) {
+    if (driven) {
+        // saturated feedback at 2x rate, input interpolated linearly
+        for (uint i = 0; i < samples; i++) {
+            float x = input[i];
+            float in = drive_shape(0.5f * (x + x1) - q * bf4, gain, norm, wet);
+            MOOG_STAGES(in)
+            float y = bf4;
+            in = drive_shape(x - q * bf4, gain, norm, wet);
+            MOOG_STAGES(in)
+            x1 = x;
+            output[i] = 0.5f * (y + bf4);
+        }
+        return;
+    }
+
     for (uint i = 0; i < samples; i++) {
         float in = input[i];
 
         in -= q * bf4; //feedback
-        t1 = bf1;  bf1 = (in + bf0) * pc - bf1 * f;
-        t2 = bf2;  bf2 = (bf1 + t1) * pc - bf2 * f;
-        t1 = bf3;  bf3 = (bf2 + t2) * pc - bf3 * f;
-        bf4 = (bf3 + t1) * pc - bf4 * f;
-        bf4 = bf4 - bf4 * bf4 * bf4 * 0.166667f;    //clipping
-        bf0 = in;
+        MOOG_STAGES(in)
 
         // Lowpass  output:  bf4
         // Highpass output:  in - bf4;
         // Bandpass output:  3.0f * (bf3 - bf4);
         output[i] = bf4;
     }
+    // kept for the interpolated input when the drive is switched on
+    if (samples > 0) {
+        x1 = input[samples - 1];
+    }
+}
+
+void MoogFilter::process(float* input, float* output, int samples) {
+    const bool driven = drive > 0.0f;
+    if (driven == driven_) {
+        run(input, output, samples, driven);
+        return;
+    }
+
+    // the rate changes with the drive, the block is rendered from the same
+    // state at the old rate as well and faded over
+    MoogFilter old = *this;
+    old.tune(driven ? sample_rate : 2.0f * sample_rate);
+    driven_ = driven;
+    float buffer[FADE_CHUNK];
+    for (int i = 0; i < samples; i += FADE_CHUNK) {
+        const int n = std::min(FADE_CHUNK, samples - i);
+        old.run(input + i, buffer, n, !driven);
+        run(input + i, output + i, n, driven);
+        crossfade(buffer, output + i, i, n, samples);
+    }
 }
 
 // StateVariableFilter
@@ -467,18 +686,40 @@ void StateVariableFilter::process(float* input, float* output, int samples) {
 
 void StateVariableFilter2::clear() {
     v0z = v1 = v2 = 0.0f;
+    x1 = 0.0f;
+    snap = true;
+}
+
+void StateVariableFilter2::setDistortion(float d) {
+    drive = d;
+    gain = drive_gain(d);
+    norm = 1.0f / fast_tanh(gain);
+    wet = drive_wet(d);
 }
 
 void StateVariableFilter2::setCoefficients(float fc, float res) {
-    float g = tan(M_PI * fc / sample_rate);
+    float rate = drive > 0.0f ? 2.0f * sample_rate : sample_rate;
+    if (fc == fc_ && res == res_ && rate == rate_) {
+        return;
+    }
+    fc_ = fc;
+    res_ = res;
+    tune(rate);
+}
+
+void StateVariableFilter2::tune(float rate) {
+    rate_ = rate;
+
     //float damping = 1.0f / res;
     //k = damping;
-    k = 1.0 - 0.99 * res;
-    float ginv = g / (1.0f + g * (g + k));
-    g1 = ginv;
-    g2 = 2.0f * (g + k) * ginv;
-    g3 = g * ginv;
-    g4 = 2.0f * ginv;
+    kt = 1.0 - 0.99 * res_;
+    float g[4];
+    svf_.linear(fc_ / rate, res_, g);
+    g1t = g[0];
+    g2t = g[1];
+    g3t = g[2];
+    g4t = g[3];
+    ramp = true;
 }
 
 #define SVF2_LOOP(x) \
@@ -493,37 +734,194 @@ void StateVariableFilter2::setCoefficients(float fc, float res) {
         output[i] = x; \
     }
 
+#define SVF2_RAMP_LOOP(x) \
+    for (uint i = 0; i < samples; i++) { \
+        k += ks; g1 += g1s; g2 += g2s; g3 += g3s; g4 += g4s; \
+        float v0 = input[i]; \
+        float v1z = v1; \
+        float v2z = v2; \
+        float v3 = v0 + v0z - 2.0 * v2z; \
+        v1 += g1 * v3 - g2 * v1z; \
+        v2 += g3 * v3 + g4 * v1z; \
+        v0z = v0; \
+        output[i] = x; \
+    }
+
+// one step at 2x rate with saturated band state, y is the output expression
+#define SVF2_DRIVE_TICK(in, y, out) \
+    { \
+        float v0 = in; \
+        float v1z = v1; \
+        float v2z = v2; \
+        float v3 = v0 + v0z - 2.0 * v2z; \
+        v1 += g1 * v3 - g2 * v1z; \
+        v2 += g3 * v3 + g4 * v1z; \
+        v1 += wet * (2.0f * fast_tanh(0.5f * v1) - v1); \
+        v0z = v0; \
+        out = y; \
+    }
+
+#define SVF2_DRIVE_LOOP(y) \
+    for (uint i = 0; i < samples; i++) { \
+        k += ks; g1 += g1s; g2 += g2s; g3 += g3s; g4 += g4s; \
+        float x = input[i]; \
+        float a, b; \
+        SVF2_DRIVE_TICK(drive_shape(0.5f * (x + x1), gain, norm, wet), y, a) \
+        SVF2_DRIVE_TICK(drive_shape(x, gain, norm, wet), y, b) \
+        x1 = x; \
+        output[i] = 0.5f * (a + b); \
+    }
+
+void StateVariableFilter2::run(float* input, float* output, int samples, bool driven) {
+    if (ramp && snap) {
+        k = kt; g1 = g1t; g2 = g2t; g3 = g3t; g4 = g4t;
+        ramp = false;
+    }
+    snap = false;
+
+    if (driven) {
+        // ramp steps are zero when the coefficients are settled
+        const float s = ramp ? 1.0f / float(samples) : 0.0f;
+        const float ks = (kt - k) * s, g1s = (g1t - g1) * s, g2s = (g2t - g2) * s;
+        const float g3s = (g3t - g3) * s, g4s = (g4t - g4) * s;
+        switch (type) {
+        case LP:
+            SVF2_DRIVE_LOOP(v2);
+            break;
+        case BP:
+            SVF2_DRIVE_LOOP(v1);
+            break;
+        case HP:
+            SVF2_DRIVE_LOOP(v0 - k * v1 - v2);
+            break;
+        case NOTCH:
+            SVF2_DRIVE_LOOP(v0 - k * v1);
+            break;
+        }
+        if (ramp) {
+            k = kt; g1 = g1t; g2 = g2t; g3 = g3t; g4 = g4t;
+            ramp = false;
+        }
+        return;
+    }
+
+    if (ramp) {
+        // linear interpolation of the coefficients over the block
+        const float s = 1.0f / float(samples);
+        const float ks = (kt - k) * s, g1s = (g1t - g1) * s, g2s = (g2t - g2) * s;
+        const float g3s = (g3t - g3) * s, g4s = (g4t - g4) * s;
+        switch (type) {
+        case LP:
+            SVF2_RAMP_LOOP(v2);
+            break;
+        case BP:
+            SVF2_RAMP_LOOP(v1);
+            break;
+        case HP:
+            SVF2_RAMP_LOOP(v0 - k * v1 - v2);
+            break;
+        case NOTCH:
+            SVF2_RAMP_LOOP(v0 - k * v1);
+            break;
+        }
+        k = kt; g1 = g1t; g2 = g2t; g3 = g3t; g4 = g4t;
+        ramp = false;
+    } else {
+        switch (type) {
+        case LP:
+            SVF2_LOOP(v2);
+            break;
+        case BP:
+            SVF2_LOOP(v1);
+            break;
+        case HP:
+            SVF2_LOOP(v0 - k * v1 - v2);
+            break;
+        case NOTCH:
+            SVF2_LOOP(v0 - k * v1);
+            break;
+        }
+    }
+    // kept for the interpolated input when the drive is switched on
+    if (samples > 0) {
+        x1 = input[samples - 1];
+    }
+}
+
 void StateVariableFilter2::process(float* input, float* output, int samples) {
-    switch (type) {
-    case LP:
-        SVF2_LOOP(v2);
-        break;
-    case BP:
-        SVF2_LOOP(v1);
-        break;
-    case HP:
-        SVF2_LOOP(v0 - k * v1 - v2);
-        break;
-    case NOTCH:
-        SVF2_LOOP(v0 - k * v1);
-        break;
+    const bool driven = drive > 0.0f;
+    if (driven == driven_) {
+        run(input, output, samples, driven);
+        return;
+    }
+
+    // the rate changes with the drive, the block is rendered from the same
+    // state at the old rate as well and faded over, the coefficients of the
+    // new rate are taken as such
+    StateVariableFilter2 old = *this;
+    old.tune(driven ? sample_rate : 2.0f * sample_rate);
+    k = kt; g1 = g1t; g2 = g2t; g3 = g3t; g4 = g4t;
+    ramp = false;
+    driven_ = driven;
+    float buffer[FADE_CHUNK];
+    for (int i = 0; i < samples; i += FADE_CHUNK) {
+        const int n = std::min(FADE_CHUNK, samples - i);
+        old.run(input + i, buffer, n, !driven);
+        run(input + i, output + i, n, driven);
+        crossfade(buffer, output + i, i, n, samples);
     }
 }
 
 // CombFilter
 
-
 void CombFilter::clear() {
-    delay.clear();
+    delay.clearLazy();
+    drive.clear();
+}
+
+void CombFilter::setMemory(DelayMemory* m) {
+    memory = m;
+    if (!memory) {
+        // standalone use, own line down to 20hz
+        delay.setMax(sample_rate / 20.0);
+    }
+}
+
+void CombFilter::release() {
+    if (memory && delay.getLength() > 0) {
+        memory->release(delay.detach());
+    }
 }
 
 void CombFilter::setCoefficients(float _fc, float _amount) {
-    delay.setDelay((1.0 / _fc) * sample_rate);
+    if (delay.getLength() == 0 && memory) {
+        float* block = memory->acquire();
+        if (block) {
+            delay.attach(block, memory->blockLength());
+            delay.clearLazy();
+        }
+    }
+    if (delay.getLength() > 0) {
+        float d = (1.0 / _fc) * sample_rate;
+        delay.setDelay(std::min(d, float(delay.getLength() - 1)));
+    }
     fc = _fc;
     amount = _amount;
 }
 
 void CombFilter::process(float* input, float* output, int samples) {
+    if (drive.active()) {
+        drive.process(input, output, samples);
+        input = output;
+    }
+    if (delay.getLength() == 0) {
+        // no line available
+        for (uint i = 0; i < samples; i++) {
+            output[i] = input[i];
+        }
+        return;
+    }
+    delay.prepare(samples);
     for (uint i = 0; i < samples; i++) {
         output[i] = input[i] + amount * delay.process(input[i]);
     }
@@ -163,6 +163,51 @@ class BiQuadDF2 : Filter {
     float b0_, b1_, b2_, a1_, a2_, z1_, z2_;
 };
 
+/**
+ * biquad filter in block state space form
+ *
+ * Same response as BiQuadDF2, but the recursion is unrolled over blocks
+ * of 4 samples: outputs and the next state are computed from the
+ * current state and 4 inputs with precomputed matrices, so the inner
+ * loops have no serial dependency and vectorize. Intended for filters
+ * with static coefficients.
+ */
+class BiQuadBlock : Filter {
+  public:
+    BiQuadBlock() { setCoefficients(1.0f, 0.0f, 0.0f, 0.0f, 0.0f); }
+    void clear();
+    void setCoefficients(float b0, float b1, float b2, float a1, float a2);
+    void setLowpass(float fc, float res);
+    void setHighpass(float fc, float res);
+    void process(float* input, float* output, int samples);
+
+  private:
+    float b0_, b1_, b2_, a1_, a2_, z1_ = 0.0f, z2_ = 0.0f;
+    float cz1_[4], cz2_[4];  // state to outputs
+    float cx_[4][4];         // inputs to outputs
+    float az1_[2], az2_[2];  // state to next state
+    float ax_[4][2];         // inputs to next state
+};
+
+/**
+ * saturating drive stage
+ *
+ * Rational tanh approximation, 2x oversampled with linear interpolation
+ * and averaging. Normalized so that unit amplitude passes unchanged, and
+ * blended with the input below an amount of 0.1, so that the gain doesn't
+ * jump when the drive is switched on.
+ */
+class Drive {
+  public:
+    void clear() { last = 0.0f; }
+    void setAmount(float d);
+    bool active() const { return amount > 0.0f; }
+    void process(float* input, float* output, int samples);
+
+  private:
+    float amount = 0.0f, gain = 1.0f, norm = 1.0f, wet = 1.0f, last = 0.0f;
+};
+
 /**
  * AmSynth filter
  * Copyright (c) 2001-2012 Nick Dowell
@@ -176,12 +221,19 @@ class AmSynthFilter : Filter {
     void setType(int t) { type_ = t;}
     void setSamplerate(float r) { sample_rate_ = r; }
     void setCoefficients(float f, float r);
+    void setDistortion(float d) { drive_.setAmount(d); }
     void process(float* input, float* output, int samples);
 
   private:
+    Drive drive_;
     double d1, d2, d3, d4;
-    float freq_, res_, sample_rate_;
-    int type_ = 0;
+    float freq_ = -1.0f, res_ = -1.0f, sample_rate_;
+    int type_ = 0, coeff_type_ = -1;
+
+    // coefficients are ramped from the current to the target values in process
+    float a0_, a1_, a2_, b1_, b2_;
+    float a0t_, a1t_, a2t_, b1t_, b2t_;
+    bool ramp_ = false, snap_ = true;
 };
 
 /**
@@ -196,13 +248,22 @@ class MoogFilter : Filter {
     void setType(int t) { type = t; }
     void setSamplerate(float r) { sample_rate = r; }
     void setCoefficients(float f, float r);
+    void setDistortion(float d);
     void process(float* input, float* output, int samples);
 
   private:
+    void tune(float rate);
+    void run(float* input, float* output, int samples, bool driven);
+
+    float fc = 0.0f, res = 0.0f;
     float f, pc, q;
     float bf0, bf1, bf2, bf3, bf4;
     float t1, t2;
 
+    // saturation in the feedback path, runs at 2x rate when enabled
+    float drive = 0.0f, gain = 1.0f, norm = 1.0f, wet = 1.0f, x1;
+    bool driven_ = false;
+
     int type = 0;
     float sample_rate;
 };
@@ -247,15 +308,28 @@ class StateVariableFilter2 : Filter {
     void setType(int t) { type = t; }
     void setSamplerate(float rate) { sample_rate = rate; }
     void setCoefficients(float fc, float res);
+    void setDistortion(float d);
     void process(float* input, float* output, int samples);
 
   private:
+    void tune(float rate);
+    void run(float* input, float* output, int samples, bool driven);
+
     float sample_rate;
     int type = 0;
 
+    // saturation of the input and band state, runs at 2x rate when enabled
+    float drive = 0.0f, gain = 1.0f, norm = 1.0f, wet = 1.0f, x1;
+    bool driven_ = false;
+
     float v0z, v1, v2;
     float k, g1, g2, g3, g4;
 
+    // coefficients are ramped from the current to the target values in process
+    float fc_ = -1.0f, res_ = -1.0f, rate_ = -1.0f;
+    float kt, g1t, g2t, g3t, g4t;
+    bool ramp = false, snap = true;
+
 };
 
 /**
@@ -264,14 +338,20 @@ class StateVariableFilter2 : Filter {
 class CombFilter : Filter {
 
   public:
+    CombFilter() : delay(0) {}
     void clear();
     void setSamplerate(float rate) { sample_rate = rate; }
+    void setMemory(DelayMemory* m);
+    void release();
     void setCoefficients(float fc, float amount);
+    void setDistortion(float d) { drive.setAmount(d); }
     void process(float* input, float* output, int samples);
 
   private:
     float sample_rate, fc, amount;
-    DelayA delay;
+    DelayA delay; // empty until the filter is used
+    DelayMemory* memory = 0;
+    Drive drive;
 
 };
 
@@ -64,4 +64,15 @@ float LFO::tick(int samples) {
     return getValue(phase);
 }
 
+void LFO::process(float* output, int samples) {
+    float inc = freq / sample_rate;
+    for (int i = 0; i < samples; i++) {
+        phase += inc;
+        if (phase >= 1.0f) {
+            phase -= 1.0f;
+        }
+        output[i] = getValue(phase);
+    }
+}
+
 }
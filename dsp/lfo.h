@@ -24,6 +24,7 @@ class LFO {
     float getValue(float p);
     float tick(int samples);
     float tick();
+    void process(float* output, int samples);
 
   private:
     int type = 0;
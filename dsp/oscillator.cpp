@@ -259,8 +259,6 @@ void Virtual::reset() {
 void Virtual::va_saw(float* output, float* out_sync, int samples) {
     el_saw(output, out_sync, samples);
 
-    filter.setType(4);
-    filter.setCoefficients(50, 0);
     filter.process(output, output, samples);
 
     for (uint i = 0; i < samples; i++) {
@@ -271,8 +269,6 @@ void Virtual::va_saw(float* output, float* out_sync, int samples) {
 void Virtual::va_tri_saw(float* output, float* out_sync, int samples) {
     el_tri(output, out_sync, samples);
 
-    filter.setType(4);
-    filter.setCoefficients(50, 0);
     filter.process(output, output, samples);
 
     for (uint i = 0; i < samples; i++) {
@@ -283,8 +279,6 @@ void Virtual::va_tri_saw(float* output, float* out_sync, int samples) {
 void Virtual::va_pulse(float* output, float* out_sync, int samples) {
     el_pulse(output, out_sync, samples);
 
-    filter.setType(4);
-    filter.setCoefficients(50, 0);
     filter.process(output, output, samples);
 
     for (uint i = 0; i < samples; i++) {
@@ -100,12 +100,12 @@ class Virtual : public Oscillator {
 
     float prev = 0.0f;
 
-    AmSynthFilter filter;
+    BiQuadBlock filter; // DC blocking for VA waveforms
 
   public:
     void setSamplerate(float r) {
         Oscillator::setSamplerate(r);
-        filter.setSamplerate(r);
+        filter.setHighpass(50.0f / r, 0.0f);
     }
 
     void clear();
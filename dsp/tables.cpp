@@ -5,7 +5,9 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <algorithm>
 #include "tables.h"
 #include "types.h"
 
@@ -83,5 +85,110 @@ float tanhtable::linear(float val) {
     return rem * values[int(pos + 1)] + (1.0f - rem) * values[int(pos)];
 }
 
+// centtable
+
+centtable cents_;
+
+centtable::centtable() {
+    for (uint i = 0; i < 1202; i++) {
+        values[i] = pow(2.0, double(i) / 1200.0);
+    }
+}
+
+float centtable::linear(float val) {
+    float octave = floorf(val * (1.0f / 1200.0f));
+    float pos = val - 1200.0f * octave;
+    uint i = std::min(uint(pos), 1199u);
+    float rem = pos - float(i);
+    return ldexpf(values[i] + rem * (values[i + 1] - values[i]), int(octave));
+}
+
+// coefficient tables
+
+// table position of normalized cutoff, uses the float exponent and mantissa
+// as a piecewise linear log2
+static inline float coeff_pos(float w) {
+    uint32_t bits;
+    memcpy(&bits, &w, sizeof(float));
+    float pos = (float(bits) * (1.0f / 8388608.0f) - 127.0f + COEFF_OCTAVES) * float(COEFF_STEPS);
+    return std::min(std::max(pos, 0.0f), float(COEFF_CUTOFFS - 1) - 0.001f);
+}
+
+// normalized cutoff of table position (inverse of coeff_pos)
+static double coeff_w(uint i) {
+    double x = double(i) / COEFF_STEPS - COEFF_OCTAVES;
+    double e = floor(x);
+    return std::min(ldexp(1.0 + (x - e), int(e)), 0.4999);
+}
+
+// bilinear interpolation of n values
+static inline void coeff_linear(const float* values, uint n, float w, float res, float* out) {
+    const float pos = coeff_pos(w);
+    const uint i = pos;
+    const float a = pos - i;
+    const float rpos = std::min(std::max(res, 0.0f), 1.0f) * (COEFF_RES - 1);
+    const uint j = std::min(uint(rpos), uint(COEFF_RES - 2));
+    const float b = rpos - j;
+    const float* v00 = values + (i * COEFF_RES + j) * n;
+    const float* v01 = v00 + n;
+    const float* v10 = v00 + COEFF_RES * n;
+    const float* v11 = v10 + n;
+    for (uint k = 0; k < n; k++) {
+        float v0 = v00[k] + b * (v01[k] - v00[k]);
+        float v1 = v10[k] + b * (v11[k] - v10[k]);
+        out[k] = v0 + a * (v1 - v0);
+    }
+}
+
+// biquadtable
+
+biquadtable biquad_;
+
+// resonance where r reaches its floor, the last row so that the floor isn't
+// interpolated over
+static const double BIQUAD_RES_MAX = 0.9995;
+
+biquadtable::biquadtable() {
+    for (uint i = 0; i < COEFF_CUTOFFS; i++) {
+        const double k = tan(M_PI * coeff_w(i));
+        const double k2 = k * k;
+        for (uint j = 0; j < COEFF_RES; j++) {
+            const double r = std::max(0.001, 2.0 * (1.0 - BIQUAD_RES_MAX * j / (COEFF_RES - 1)));
+            const double rk = r * k;
+            const double bh = 1.0 + rk + k2;
+            values[i][j][LP] = k2 / bh;
+            values[i][j][HP] = 1.0 / bh;
+            values[i][j][BP] = rk / bh;
+            values[i][j][B1] = (2.0 * (k2 - 1.0)) / bh;
+            values[i][j][B2] = (1.0 - rk + k2) / bh;
+        }
+    }
+}
+
+void biquadtable::linear(float w, float res, float* out) {
+    coeff_linear(&values[0][0][0], 5, w, res * float(1.0 / BIQUAD_RES_MAX), out);
+}
+
+// svftable
+
+svftable svf_;
+
+svftable::svftable() {
+    for (uint i = 0; i < COEFF_CUTOFFS; i++) {
+        const double g = tan(M_PI * coeff_w(i));
+        for (uint j = 0; j < COEFF_RES; j++) {
+            const double k = 1.0 - 0.99 * double(j) / (COEFF_RES - 1);
+            const double ginv = g / (1.0 + g * (g + k));
+            values[i][j][0] = ginv;
+            values[i][j][1] = 2.0 * (g + k) * ginv;
+            values[i][j][2] = g * ginv;
+            values[i][j][3] = 2.0 * ginv;
+        }
+    }
+}
+
+void svftable::linear(float w, float res, float* out) {
+    coeff_linear(&values[0][0][0], 4, w, res, out);
+}
 
 }
@@ -46,6 +46,58 @@ struct tanhtable {
 
 extern tanhtable tanh_;
 
+/*
+ * frequency ratio of cents (2^(c / 1200)), one octave in cent steps,
+ * other octaves are exponent shifts
+ */
+struct centtable {
+    float values[1202];
+    centtable();
+    float linear(float cents);
+};
+
+extern centtable cents_;
+
+/*
+ * filter coefficient tables
+ *
+ * indexed by normalized cutoff (fc / sample rate, 32 steps per octave
+ * from 2^-15 to 0.5) and resonance (0 - 1, 16 steps), so a single
+ * table serves all sample rates and filter instances
+ */
+
+#define COEFF_OCTAVES 15
+#define COEFF_STEPS 32
+#define COEFF_CUTOFFS (COEFF_STEPS * COEFF_OCTAVES + 2)
+#define COEFF_RES 17
+
+/*
+ * biquad coefficients as used by AmSynthFilter and BiQuadDF2
+ *
+ * LP: a0 = a2 = lp, a1 = 2 lp
+ * HP: a0 = a2 = hp, a1 = -2 hp
+ * BP: a0 = bp, a1 = 0, a2 = -bp
+ */
+struct biquadtable {
+    enum {LP, HP, BP, B1, B2};
+    float values[COEFF_CUTOFFS][COEFF_RES][5];
+    biquadtable();
+    void linear(float w, float res, float* out);
+};
+
+extern biquadtable biquad_;
+
+/*
+ * g1 - g4 of StateVariableFilter2 (k = 1 - 0.99 res)
+ */
+struct svftable {
+    float values[COEFF_CUTOFFS][COEFF_RES][4];
+    svftable();
+    void linear(float w, float res, float* out);
+};
+
+extern svftable svf_;
+
 }
 
 #endif
@@ -0,0 +1,170 @@
+/*
+ * rogue - multimode synth
+ *
+ * Copyright (C) 2013 Timo Westkämper
+ */
+
+#include "tuning.h"
+
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace dsp {
+
+// next line that isn't a comment
+static bool next_line(std::ifstream& in, std::string& line) {
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] != '!') {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int floor_div(int a, int b) {
+    return a >= 0 ? a / b : -((b - 1 - a) / b);
+}
+
+// pitch of a scale line, cents if it has a period, a ratio otherwise
+static bool parse_pitch(const std::string& line, double& cents) {
+    std::string token;
+    std::istringstream(line) >> token;
+    const char* s = token.c_str();
+    char* end;
+    if (token.find('.') != std::string::npos) {
+        cents = strtod(s, &end);
+        return end != s;
+    }
+    double num = strtol(s, &end, 10), den = 1.0;
+    if (end != s && *end == '/') {
+        const char* d = end + 1;
+        den = strtol(d, &end, 10);
+    }
+    if (end == s || num <= 0.0 || den <= 0.0) {
+        return false;
+    }
+    cents = 1200.0 * log2(num / den);
+    return true;
+}
+
+Tuning::Tuning() {
+    for (uint k = 0; k < 128; k++) {
+        freqs[k] = 440.0 * pow(2.0, (double(k) - 69.0) / 12.0);
+    }
+    update();
+}
+
+void Tuning::update() {
+    for (uint k = 0; k < 127; k++) {
+        steps[k] = 1200.0 * log2(double(freqs[k + 1]) / double(freqs[k]));
+    }
+    steps[127] = steps[126];
+}
+
+bool Tuning::load(const char* scl, const char* kbm) {
+    // scale, degree 0 is the unison and the last degree the period
+    std::ifstream in(scl);
+    std::string line;
+    if (!next_line(in, line) || !next_line(in, line)) { // description, count
+        return false;
+    }
+    int count = atoi(line.c_str());
+    if (count < 1) {
+        return false;
+    }
+    std::vector<double> scale(count + 1, 0.0);
+    for (int i = 1; i <= count; i++) {
+        if (!next_line(in, line) || !parse_pitch(line, scale[i])) {
+            return false;
+        }
+    }
+
+    // keyboard mapping, middle C on the unison by default
+    int size = 0, first = 0, last = 127, middle = 60, reference = 60, octave = count;
+    double reference_freq = 261.625565;
+    std::vector<int> map;
+    if (kbm) {
+        std::ifstream in(kbm);
+        int values[5];
+        for (int i = 0; i < 5; i++) {
+            if (!next_line(in, line)) {
+                return false;
+            }
+            values[i] = atoi(line.c_str());
+        }
+        size = values[0];
+        first = values[1];
+        last = values[2];
+        middle = values[3];
+        reference = values[4];
+        if (!next_line(in, line) || (reference_freq = atof(line.c_str())) <= 0.0) {
+            return false;
+        }
+        if (!next_line(in, line)) {
+            return false;
+        }
+        octave = atoi(line.c_str());
+        if (size < 0 || (size > 0 && octave == 0)) {
+            return false;
+        }
+        // missing and x entries are unmapped
+        map.assign(size, -1);
+        for (int i = 0; i < size && next_line(in, line); i++) {
+            if (line.find('x') == std::string::npos) {
+                map[i] = atoi(line.c_str());
+            }
+        }
+    }
+
+    // scale degree of a key, -1 if unmapped
+    auto degree = [&](int key, bool& mapped) {
+        int i = key - middle;
+        mapped = true;
+        if (size == 0) {
+            return i;
+        }
+        int o = floor_div(i, size);
+        int d = map[i - o * size];
+        mapped = d >= 0;
+        return d + o * octave;
+    };
+    auto cents = [&](int d) {
+        int o = floor_div(d, count);
+        return o * scale[count] + scale[d - o * count];
+    };
+
+    bool mapped;
+    int d = degree(reference, mapped);
+    if (!mapped) {
+        return false;
+    }
+    const double reference_cents = cents(d);
+
+    // unmapped keys take the frequency of the previous mapped key, or of
+    // the first one
+    float values[128];
+    int previous = -1;
+    for (int k = 0; k < 128; k++) {
+        d = degree(k, mapped);
+        if (mapped && k >= first && k <= last) {
+            values[k] = reference_freq * pow(2.0, (cents(d) - reference_cents) / 1200.0);
+            if (previous < 0) {
+                std::fill(values, values + k, values[k]);
+            }
+            previous = k;
+        } else if (previous >= 0) {
+            values[k] = values[previous];
+        }
+    }
+    if (previous < 0) {
+        return false;
+    }
+    std::copy(values, values + 128, freqs);
+    update();
+    return true;
+}
+
+}
@@ -0,0 +1,44 @@
+/*
+ * rogue - multimode synth
+ *
+ * Copyright (C) 2013 Timo Westkämper
+ */
+
+#ifndef DSP_TUNING_H
+#define DSP_TUNING_H
+
+#include <math.h>
+#include <algorithm>
+#include "tables.h"
+#include "types.h"
+
+namespace dsp {
+
+/**
+ * frequencies of the MIDI keys
+ *
+ * Equal temperament by default, other tunings are loaded from Scala scale
+ * (.scl) and keyboard mapping (.kbm) files. Fractional keys are
+ * interpolated in cents between the neighbouring keys.
+ */
+class Tuning {
+    float freqs[128];
+    float steps[128]; // cents to the next key
+
+    void update();
+
+  public:
+    Tuning();
+
+    /** loads a scale with an optional mapping, false on errors */
+    bool load(const char* scl, const char* kbm = 0);
+
+    float freq(float key) const {
+        int k = std::min(std::max(int(floorf(key)), 0), 126);
+        return freqs[k] * cents_.linear((key - float(k)) * steps[k]);
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * rogue - multimode synth
+ *
+ * Copyright (C) 2013 Timo Westkämper
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "worker.h"
+
+namespace dsp {
+
+Worker::Worker() : head(0), running(false) {
+    for (uint i = 0; i < QUEUE; i++) {
+        queue[i].seq = i;
+    }
+    sem_init(&ready, 0, 0);
+}
+
+Worker::~Worker() {
+    stop();
+    sem_destroy(&ready);
+}
+
+void Worker::stop() {
+    if (running) {
+        running = false;
+        sem_post(&ready);
+        thread.join();
+    }
+}
+
+void Worker::start(bool background) {
+    if (!running) {
+        running = true;
+        thread = std::thread(&Worker::loop, this);
+        if (background) {
+            sched_param param = {0};
+            pthread_setschedparam(thread.native_handle(), SCHED_IDLE, &param);
+        }
+    }
+}
+
+bool Worker::post(Job* job) {
+    if (!running) {
+        return false;
+    }
+    // claim the slot at the head, full when the worker hasn't freed it yet
+    uint pos = head.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true) {
+        slot = &queue[pos % QUEUE];
+        int diff = int(slot->seq.load(std::memory_order_acquire) - pos);
+        if (diff < 0) {
+            return false;
+        } else if (diff > 0) {
+            pos = head.load(std::memory_order_relaxed);
+        } else if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    slot->job = job;
+    slot->seq.store(pos + 1, std::memory_order_release);
+    sem_post(&ready);
+    return true;
+}
+
+void Worker::loop() {
+    while (true) {
+        // retried when interrupted by a signal
+        while (sem_wait(&ready) != 0) {}
+        if (!running) {
+            break;
+        }
+        // a later slot may be published first, the poster of this one is
+        // between claiming and publishing it
+        Slot& slot = queue[tail % QUEUE];
+        while (slot.seq.load(std::memory_order_acquire) != tail + 1) {
+            std::this_thread::yield();
+        }
+        Job* job = slot.job;
+        slot.seq.store(tail + QUEUE, std::memory_order_release);
+        tail++;
+        job->work();
+    }
+}
+
+}
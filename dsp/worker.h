@@ -0,0 +1,65 @@
+/*
+ * rogue - multimode synth
+ *
+ * Copyright (C) 2013 Timo Westkämper
+ */
+
+#ifndef DSP_WORKER_H
+#define DSP_WORKER_H
+
+#include <atomic>
+#include <thread>
+#include <semaphore.h>
+#include "types.h"
+
+namespace dsp {
+
+/**
+ * background thread for jobs of the audio thread
+ *
+ * The thread is started by the owner up front and sleeps on a semaphore
+ * until a job is posted, jobs run in posting order. Posting is lock free,
+ * a poster claims a slot of the ring, publishes the job in it and raises
+ * the semaphore, several threads may post. The audio thread never waits
+ * for a job, owners treat results that aren't ready in time as late.
+ */
+class Worker {
+  public:
+    struct Job {
+        virtual void work() = 0;
+    };
+
+    Worker();
+    ~Worker();
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+    /** starts the thread, background threads run at the lowest priority, not realtime safe */
+    void start(bool background = false);
+    /** lets the running job finish and stops the thread */
+    void stop();
+    bool started() const { return running; }
+    /** queues a job, false if the worker isn't started or the queue is full, realtime safe */
+    bool post(Job* job);
+
+  private:
+    static const uint QUEUE = 16;
+    void loop();
+
+    // the sequence of a slot is its position when free and the position
+    // plus one when its job is published
+    struct Slot {
+        std::atomic<uint> seq;
+        Job* job;
+    };
+
+    Slot queue[QUEUE];
+    std::atomic<uint> head;
+    uint tail = 0; // worker side
+    std::atomic<bool> running;
+    sem_t ready;
+    std::thread thread;
+};
+
+}
+
+#endif
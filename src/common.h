@@ -11,9 +11,13 @@
 #include <stdint.h>
 
 #define NOUTS    2       // number of outputs
-#define NVOICES 32       // max polyphony
+#define MAX_VOICES 128   // max polyphony
+#define MAX_UNISON 8     // stacked copies of the oscillators and filters per voice
+#define NPARTS 16        // parts of the multi-timbral mode, one per MIDI channel
 #define SILENCE 0.00001f  // voice choking
 #define BUFFER_SIZE 64
+#define MOD_STEP 8        // segment length for audio rate modulation
+#define SEMITONE 1.05946f
 
 // number of elements
 #define NOSC    4
@@ -27,7 +31,7 @@
 #define DCF_OFF 10
 #define LFO_OFF 8
 #define ENV_OFF 9
-#define MOD_OFF 3
+#define MOD_OFF 4
 
 typedef uint32_t uint;
 
@@ -78,6 +82,8 @@ enum {
   M_ENV4_S, M_ENV4_AMP,
   // bus
   M_BUSA_PAN, M_BUSB_PAN,
+  // unison
+  M_UNISON_DETUNE, M_UNISON_SPREAD,
   M_TARGET_SIZE
 };
 
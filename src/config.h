@@ -9,7 +9,11 @@
 #ifndef ROGUE_CONFIG_H
 #define ROGUE_CONFIG_H
 
+#include <algorithm>
+
 #include "common.h"
+#include "envelope.h"
+#include "tuning.h"
 
 namespace rogue {
 
@@ -35,8 +39,15 @@ struct FilterData {
     float level, pan;
 
     // modulation
-    float key_to_f;
-    float vel_to_f;
+    float key_to_f = 0.0f;
+    float vel_to_f = 0.0f;
+    float key_scale[128], vel_scale[128]; // cutoff factors per key and velocity
+
+    FilterData() {
+        for (uint i = 0; i < 128; i++) {
+            key_scale[i] = vel_scale[i] = 1.0f;
+        }
+    }
 };
 
 struct LFOData {
@@ -56,13 +67,41 @@ struct EnvData {
     float attack, hold, decay, sustain, release;
     float curve;
     bool retrigger;
+
+    // envelope with these settings at full speed, built by the synth with
+    // the voice configuration and copied at note-on
+    dsp::AHDSR shape;
+    bool shaped = false;
+
+    void configure(dsp::AHDSR& env, float speed) const {
+        env.setRetrigger(retrigger);
+        env.setCurve(curve);
+        env.setPredelay(pre_delay / speed);
+        env.setAHDSR(std::max(attack / speed, 0.001f), hold / speed, decay / speed, sustain, release / speed);
+    }
 };
 
 struct ModulationData {
     uint src = 0, target = 0;
     float amount = 0.0;
+    bool audio = false; // evaluated per sample
 };
 
+// sources that vary within a block
+inline bool is_audio_source(uint src) {
+    return src >= M_LFO1_BI && src <= M_ENV4;
+}
+
+// targets that can consume per sample modulation
+inline bool is_audio_target(uint target) {
+    if (target >= M_OSC1_P && target <= M_OSC4_AMP) {
+        return (target - M_OSC1_P) % 4 != 1; // no MOD
+    } else if (target >= M_DCF1_F && target <= M_DCF2_AMP) {
+        return (target - M_DCF1_F) % 4 != 2; // no PAN
+    }
+    return false;
+}
+
 struct SynthData {
     OscData oscs[NOSC];
     FilterData filters[NDCF];
@@ -70,15 +109,24 @@ struct SynthData {
     EnvData envs[NENV];
     ModulationData mods[NMOD];
     uint mod_count;
+    bool audio_sources[M_SIZE] = {};
+    bool audio_targets[M_TARGET_SIZE] = {};
+    bool targets[M_TARGET_SIZE] = {}; // control rate targets
 
     uint oversample = 2;
+    uint control_rate = BUFFER_SIZE; // samples per control tick
 
     float pitch_bend;
+    dsp::Tuning tuning;
     uint playmode;
     float bus_a_level, bus_a_pan;
     float bus_b_level, bus_b_pan;
-    float volume;
+    uint unison = 1; // lanes per voice
+    float unison_detune, unison_spread;
+    float send = 1.0f; // share of the output that goes through the effects
     float glide_time, bend_range;
+
+    uint version = 0; // changes with the voice configuration
 };
 
 }
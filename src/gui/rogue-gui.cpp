@@ -144,20 +144,75 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createSelect(p_play_mode, modes, 3), 0, 1);
         grid->addWidget(createDial(p_glide_time), 0, 2);
         grid->addWidget(createDial(p_pitchbend_range), 0, 3);
+        grid->addWidget(createSelect(p_control_rate, control_rates, 4), 0, 4);
+        grid->addWidget(createToggle(p_fx_thread, "Thread"), 0, 5);
+        grid->addWidget(createToggle(p_limiter_on, "Limit"), 0, 6);
+        grid->addWidget(createDial(p_limiter_ceiling), 0, 7);
+        grid->addWidget(createSelect(p_voice_steal, steal_modes, 4), 0, 8);
+        grid->addWidget(createSpin(p_polyphony), 0, 9);
+        grid->addWidget(createToggle(p_governor_on, "Govern"), 0, 10);
+        grid->addWidget(createDial(p_load_high), 0, 11);
+        grid->addWidget(createDial(p_load_low), 0, 12);
+        grid->addWidget(createSpin(p_tuning), 0, 15);
+        grid->addWidget(createSpin(p_unison_voices), 0, 16);
+        grid->addWidget(createDial(p_unison_detune), 0, 17);
+        grid->addWidget(createDial(p_unison_spread), 0, 18);
+        grid->addWidget(createToggle(p_multi_on, "Multi"), 0, 19);
+        grid->addWidget(createSpin(p_edit_part), 0, 20);
+        grid->addWidget(createSpin(p_part_voices), 0, 21);
+        grid->addWidget(createDial(p_part_send), 0, 22);
         // row 2
         grid->addWidget(new QLabel("Vol"),  1, 0);
         grid->addWidget(new QLabel("Mode"), 1, 1);
         grid->addWidget(new QLabel("Glide t."), 1, 2);
         grid->addWidget(new QLabel("Bend r."), 1, 3);
+        grid->addWidget(new QLabel("Ctrl rate"), 1, 4);
+        grid->addWidget(new QLabel("FX"), 1, 5);
+        grid->addWidget(new QLabel("Limiter"), 1, 6);
+        grid->addWidget(new QLabel("Ceiling"), 1, 7);
+        grid->addWidget(new QLabel("Steal"), 1, 8);
+        grid->addWidget(new QLabel("Voices"), 1, 9);
+        grid->addWidget(new QLabel("Load"), 1, 10);
+        grid->addWidget(new QLabel("High"), 1, 11);
+        grid->addWidget(new QLabel("Low"), 1, 12);
+        grid->addWidget(new QLabel("Level"), 1, 13);
+        grid->addWidget(new QLabel("Xruns"), 1, 14);
+        grid->addWidget(new QLabel("Tuning"), 1, 15);
+        grid->addWidget(new QLabel("Unison"), 1, 16);
+        grid->addWidget(new QLabel("Detune"), 1, 17);
+        grid->addWidget(new QLabel("Spread"), 1, 18);
+        grid->addWidget(new QLabel("Parts"), 1, 19);
+        grid->addWidget(new QLabel("Edit"), 1, 20);
+        grid->addWidget(new QLabel("Part v."), 1, 21);
+        grid->addWidget(new QLabel("FX send"), 1, 22);
         // row 3
         grid->addWidget(createLabel(p_volume), 2, 0);
         // skip
         grid->addWidget(createLabel(p_glide_time), 2, 2);
         grid->addWidget(createLabel(p_pitchbend_range), 2, 3);
+        // skip
+        grid->addWidget(createLabel(p_latency), 2, 5);
+        // skip
+        grid->addWidget(createLabel(p_limiter_ceiling), 2, 7);
+        // skip
+        // skip
+        grid->addWidget(createLabel(p_cpu_load), 2, 10);
+        grid->addWidget(createLabel(p_load_high), 2, 11);
+        grid->addWidget(createLabel(p_load_low), 2, 12);
+        grid->addWidget(createLabel(p_degradation), 2, 13);
+        grid->addWidget(createLabel(p_xrun_risk), 2, 14);
+        // skip
+        // skip
+        grid->addWidget(createLabel(p_unison_detune), 2, 17);
+        grid->addWidget(createLabel(p_unison_spread), 2, 18);
+        // skip
+        // skip
+        // skip
+        grid->addWidget(createLabel(p_part_send), 2, 22);
 
         grid->setHorizontalSpacing(2);
         grid->setVerticalSpacing(0);
-        grid->setColumnStretch(4, 1);
+        grid->setColumnStretch(23, 1);
         grid->setRowStretch(3, 1);
         return parent;
     }
@@ -173,12 +228,16 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createDial(p_chorus_rate), 0, 2);
         grid->addWidget(createDial(p_chorus_depth), 0, 3);
         grid->addWidget(createDial(p_chorus_feedback), 0, 4);
+        grid->addWidget(createSpin(p_chorus_taps), 0, 5);
+        grid->addWidget(createSpin(p_chorus_order), 0, 6);
         // row 2
         grid->addWidget(new QLabel("Delay"), 1, 0);
         grid->addWidget(new QLabel("Mod amt"), 1, 1);
         grid->addWidget(new QLabel("Mod frq"), 1, 2);
         grid->addWidget(new QLabel("Depth"), 1, 3);
         grid->addWidget(new QLabel("Feedb"), 1, 4);
+        grid->addWidget(new QLabel("Taps"), 1, 5);
+        grid->addWidget(new QLabel("Order"), 1, 6);
         // row 3
         grid->addWidget(createLabel(p_chorus_delay), 2, 0);
         grid->addWidget(createLabel(p_chorus_amount), 2, 1);
@@ -187,7 +246,7 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createLabel(p_chorus_feedback), 2, 4);
         grid->setHorizontalSpacing(2);
         grid->setVerticalSpacing(0);
-        grid->setColumnStretch(5, 1);
+        grid->setColumnStretch(7, 1);
         return parent;
     }
 
@@ -202,12 +261,16 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createDial(p_phaser_rate), 0, 2);
         grid->addWidget(createDial(p_phaser_depth), 0, 3);
         grid->addWidget(createDial(p_phaser_feedback), 0, 4);
+        grid->addWidget(createSpin(p_phaser_stages), 0, 5);
+        grid->addWidget(createSpin(p_phaser_order), 0, 6);
         // row 2
         grid->addWidget(new QLabel("Min Fr"), 1, 0);
         grid->addWidget(new QLabel("Max Fr"), 1, 1);
         grid->addWidget(new QLabel("Mod frq"), 1, 2);
         grid->addWidget(new QLabel("Depth"), 1, 3);
         grid->addWidget(new QLabel("Feedb"), 1, 4);
+        grid->addWidget(new QLabel("Stages"), 1, 5);
+        grid->addWidget(new QLabel("Order"), 1, 6);
         // row 3
         grid->addWidget(createLabel(p_phaser_min_freq), 2, 0);
         grid->addWidget(createLabel(p_phaser_max_freq), 2, 1);
@@ -216,7 +279,7 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createLabel(p_phaser_feedback), 2, 4);
         grid->setHorizontalSpacing(2);
         grid->setVerticalSpacing(0);
-        grid->setColumnStretch(5, 1);
+        grid->setColumnStretch(7, 1);
         return parent;
     }
 
@@ -234,6 +297,7 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createDial(p_delay_pingpong), 0, 5);
         grid->addWidget(createDial(p_delay_lowcut), 0, 6);
         grid->addWidget(createDial(p_delay_highcut), 0, 7);
+        grid->addWidget(createSpin(p_delay_order), 0, 8);
         // row 2
         grid->addWidget(new QLabel("BPM"), 1, 0);
         grid->addWidget(new QLabel("Divider L"), 1, 1);
@@ -243,6 +307,7 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(new QLabel("Pingpong"), 1, 5);
         grid->addWidget(new QLabel("Lowcut"), 1, 6);
         grid->addWidget(new QLabel("Highcut"), 1, 7);
+        grid->addWidget(new QLabel("Order"), 1, 8);
         // row 3
         grid->addWidget(createLabel(p_delay_bpm), 2, 0);
         grid->addWidget(createLabel(p_delay_divider_l), 2, 1);
@@ -254,7 +319,7 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createLabel(p_delay_highcut), 2, 7);
         grid->setHorizontalSpacing(2);
         grid->setVerticalSpacing(0);
-        grid->setColumnStretch(8, 1);
+        grid->setColumnStretch(9, 1);
         return parent;
     }
 
@@ -269,12 +334,14 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createDial(p_reverb_lowcut), 0, 2);
         grid->addWidget(createDial(p_reverb_highcut), 0, 3);
         grid->addWidget(createDial(p_reverb_depth), 0, 4);
+        grid->addWidget(createSpin(p_reverb_order), 0, 5);
         // row 2
         grid->addWidget(new QLabel("Predelay"), 1, 0);
         grid->addWidget(new QLabel("Decay"), 1, 1);
         grid->addWidget(new QLabel("Lowcut"), 1, 2);
         grid->addWidget(new QLabel("Highcut"), 1, 3);
         grid->addWidget(new QLabel("Depth"), 1, 4);
+        grid->addWidget(new QLabel("Order"), 1, 5);
         // row 4
         grid->addWidget(createLabel(p_reverb_predelay), 2, 0);
         grid->addWidget(createLabel(p_reverb_decay), 2, 1);
@@ -283,7 +350,28 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createLabel(p_reverb_depth), 2, 4);
         grid->setHorizontalSpacing(2);
         grid->setVerticalSpacing(0);
-        grid->setColumnStretch(5, 1);
+        grid->setColumnStretch(6, 1);
+        return parent;
+    }
+
+    QWidget* createConvolution(QGroupBox* parent) {
+        parent->setObjectName("convolution");
+        parent->setCheckable(true);
+        connectBox(p_conv_on, parent);
+        QGridLayout* grid = new QGridLayout(parent);
+        // row 1
+        grid->addWidget(createSpin(p_conv_ir), 0, 0);
+        grid->addWidget(createDial(p_conv_depth), 0, 1);
+        grid->addWidget(createSpin(p_conv_order), 0, 2);
+        // row 2
+        grid->addWidget(new QLabel("IR"), 1, 0);
+        grid->addWidget(new QLabel("Depth"), 1, 1);
+        grid->addWidget(new QLabel("Order"), 1, 2);
+        // row 3
+        grid->addWidget(createLabel(p_conv_depth), 2, 1);
+        grid->setHorizontalSpacing(2);
+        grid->setVerticalSpacing(0);
+        grid->setColumnStretch(3, 1);
         return parent;
     }
 
@@ -295,6 +383,7 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         grid->addWidget(createPhaser(new QGroupBox("Phaser")), 0, 1);
         grid->addWidget(createDelay(new QGroupBox("Delay")), 0, 2);
         grid->addWidget(createReverb(new QGroupBox("Reverb")), 1, 0, 1, 2);
+        grid->addWidget(createConvolution(new QGroupBox("Convolution")), 1, 2);
         grid->setRowStretch(2, 1);
         return parent;
     }
@@ -607,7 +696,8 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
             grid->addWidget(createSelect(p_mod1_src + off, mod_src_labels, M_SIZE), j, 0);
             grid->addWidget(createSelect(p_mod1_target + off, mod_target_labels, M_TARGET_SIZE), j + 1, 0);
             grid->addWidget(createDial(p_mod1_amount + off), j, 1, 2, 1);
-            off += 3;
+            grid->addWidget(createToggle(p_mod1_audio + off, "AR"), j, 2, 2, 1);
+            off += MOD_OFF;
         }
         grid->setSpacing(1);
         grid->setRowStretch(10, 1);
@@ -618,9 +708,9 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         parent->setObjectName("mod");
         QGridLayout* grid = new QGridLayout(parent);
         grid->addWidget(createMod(new QGroupBox(), 0), 0, 0);
-        grid->addWidget(createMod(new QGroupBox(), 15), 0, 1);
-        grid->addWidget(createMod(new QGroupBox(), 30), 0, 2);
-        grid->addWidget(createMod(new QGroupBox(), 45), 0, 3);
+        grid->addWidget(createMod(new QGroupBox(), 5 * MOD_OFF), 0, 1);
+        grid->addWidget(createMod(new QGroupBox(), 10 * MOD_OFF), 0, 2);
+        grid->addWidget(createMod(new QGroupBox(), 15 * MOD_OFF), 0, 3);
         return parent;
     }
 
@@ -814,13 +904,17 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
 
     // host to UI
     void port_event(uint port, uint buffer_size, uint format, const void* buffer) {
-        if (port > 2) {
+        if (port > 2 && widgets[port]) {
             widgets[port]->set_value(*static_cast<const float*>(buffer));
+        } else if (port > 2 && labels[port]) {
+            // output ports
+            labels[port]->setNum(*static_cast<const float*>(buffer));
         }
     }
 
     rogueGUI(const char* URI) {
         for (uint i = 0; i < p_n_ports; i++) {
+            widgets[i] = 0;
             labels[i] = 0;
         }
 
@@ -914,7 +1008,7 @@ class rogueGUI : public QObject, public lvtk::UI<rogueGUI, lvtk::QtUI<true>, lvt
         ((QDial*)createDial(p_osc1_out_mod))->setParent(&dummyParent);
 
         for (uint i = 3; i < p_n_ports; i++) {
-            if (!widgets[i])
+            if (!widgets[i] && !labels[i])
                 std::cout << "Port "<< i << " not mapped!" << std::endl;
         }
     }
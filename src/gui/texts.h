@@ -6,6 +6,10 @@
 
 CHARS modes[] = {"Poly", "Mono", "Legato"};
 
+CHARS steal_modes[] = {"Oldest", "Quietest", "Same key", "Released"};
+
+CHARS control_rates[] = {"8", "16", "32", "64"};
+
 // checkbox content
 CHARS osc_types[] = {
         // V
@@ -74,7 +78,9 @@ CHARS mod_target_labels[]  = {
         "Env 3 Sp", "Env 3 Amp",
         "Env 4 Sp", "Env 4 Amp",
         // bus
-        "Bus A Pan", "Bus B Pan"};
+        "Bus A Pan", "Bus B Pan",
+        // unison
+        "Unison Det", "Unison Spr"};
 
 CHARS out_mod[] = {"-", "Add", "RM", "AM"};
 
@@ -8,161 +8,580 @@
 
 #include "synth.h"
 
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+
 namespace rogue {
 
 rogueSynth::rogueSynth(double rate)
-  : lvtk::Synth<rogueVoice, rogueSynth>(p_n_ports, p_control) {
+  : lvtk::Synth<rogueVoice, rogueSynth, lvtk::State<false> >(p_n_ports, p_control) {
 
     sample_rate = rate;
     ldcBlocker.setSamplerate(sample_rate);
     rdcBlocker.setSamplerate(sample_rate);
 
-    for (uint i = 0; i < NVOICES; i++) {
-        voices[i] = new rogueVoice(rate, &data, left, right);
-        add_voices(voices[i]);
+    // delay lines of the effects, the voices own their comb lines
+    uint effect_memory = dsp::ChorusEffect::memorySize(sample_rate)
+                       + dsp::DelayEffect::memorySize(sample_rate)
+                       + dsp::ReverbEffect::memorySize(sample_rate);
+    delay_memory.allocate(effect_memory, 0, 0);
+
+    // the first voices are built here, the worker builds the rest when the
+    // polyphony asks for them
+    for (uint i = 0; i < MAX_VOICES; i++) {
+        voices[i] = i < FIRST_VOICES ? newVoice() : 0;
+        is_active[i] = false;
+        voice_next[i] = -1;
+        voice_note[i] = -1;
+        voice_part[i] = 0;
+        voice_age[i] = 0;
     }
+    std::fill(key_voice, key_voice + NPARTS * 128, -1);
 
-    chorus_fx.setSamplerate(sample_rate);
+    chorus_fx.setSamplerate(sample_rate, delay_memory);
     phaser_fx.setSamplerate(sample_rate);
-    delay_fx.setSamplerate(sample_rate);
-    reverb_fx.setSamplerate(sample_rate);
+    delay_fx.setSamplerate(sample_rate, delay_memory);
+    reverb_fx.setSamplerate(sample_rate, delay_memory);
+    conv_fx.setSamplerate(sample_rate);
+    conv_fx.setWorker(&worker);
+    conv_fx.setLoader(&loader);
+    limiter.setSamplerate(sample_rate);
+
+    state_parts = map((std::string(p_uri) + "#parts").c_str());
+    state_chunk = map("http://lv2plug.in/ns/ext/atom#Chunk");
+
+    // impulse responses of the bundle, selected by index
+    std::string ir_dir = std::string(bundle_path()) + "/irs/";
+    if (DIR* dir = opendir(ir_dir.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            const char* ext = strrchr(entry->d_name, '.');
+            if (ext && strcasecmp(ext, ".wav") == 0) {
+                ir_paths.push_back(ir_dir + entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(ir_paths.begin(), ir_paths.end());
+    }
+
+    // scales of the bundle with keyboard mappings of the same name
+    std::string tuning_dir = std::string(bundle_path()) + "/tunings/";
+    std::vector<std::string> scales;
+    if (DIR* dir = opendir(tuning_dir.c_str())) {
+        while (dirent* entry = readdir(dir)) {
+            const char* ext = strrchr(entry->d_name, '.');
+            if (ext && strcasecmp(ext, ".scl") == 0) {
+                scales.push_back(tuning_dir + entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(scales.begin(), scales.end());
+    }
+    tunings.push_back(dsp::Tuning());
+    for (const std::string& scale : scales) {
+        std::string kbm = scale.substr(0, scale.size() - 4) + ".kbm";
+        dsp::Tuning tuning;
+        if (tuning.load(scale.c_str(), access(kbm.c_str(), R_OK) == 0 ? kbm.c_str() : 0)) {
+            tunings.push_back(tuning);
+        }
+    }
+
+    EffectSlot slots[NEFFECTS] = {
+        {&chorus_fx, p_chorus_on, p_chorus_order, p_chorus_delay, p_chorus_taps},
+        {&phaser_fx, p_phaser_on, p_phaser_order, p_phaser_min_freq, p_phaser_stages},
+        {&delay_fx,  p_delay_on,  p_delay_order,  p_delay_bpm,    p_delay_highcut},
+        {&reverb_fx, p_reverb_on, p_reverb_order, p_reverb_predelay, p_reverb_depth},
+        {&conv_fx,   p_conv_on,   p_conv_order,   p_conv_ir,      p_conv_depth}};
+    for (uint i = 0; i < NEFFECTS; i++) {
+        effects[i] = slots[i];
+        effects[i].dirty = true;
+    }
+    std::fill(chain_ports, chain_ports + 2 * NEFFECTS, -1.0f);
 
     add_audio_outputs(p_left, p_right);
 
     converter_l = src_new(SRC_SINC_MEDIUM_QUALITY, 1, 0);
     converter_r = src_new(SRC_SINC_MEDIUM_QUALITY, 1, 0);
+    converter_bl = src_new(SRC_SINC_MEDIUM_QUALITY, 1, 0);
+    converter_br = src_new(SRC_SINC_MEDIUM_QUALITY, 1, 0);
 
-    converter_data.src_ratio = 1.0 / float(data.oversample);
+    converter_data.src_ratio = 1.0 / float(oversample);
     converter_data.end_of_input = 0;
+
+    std::fill(&fx_buffer[0][0], &fx_buffer[0][0] + 4 * FX_BLOCK_MAX, 0.0f);
+    job_state = IDLE;
+    pipeline_job.synth = this;
+    voice_count = FIRST_VOICES;
+    voice_job.synth = this;
+    voice_job.state = IDLE;
+    lane_job.sample_rate = oversample * sample_rate;
+    lane_job.state = IDLE;
+
+    // started up front, the audio thread only posts
+    worker.start();
+    loader.start(true);
 }
 
 rogueSynth::~rogueSynth() {
+    worker.stop();
+    if (lane_job.state == DONE) {
+        delete[] lane_job.lanes;
+    }
+    for (uint i = 0; i < lane_chunk_count; i++) {
+        delete[] lane_chunks[i];
+    }
+    for (uint i = 0; i < MAX_VOICES; i++) {
+        delete voices[i];
+    }
     src_delete(converter_l);
     src_delete(converter_r);
+    src_delete(converter_bl);
+    src_delete(converter_br);
 }
 
-unsigned rogueSynth::find_free_voice(unsigned char key, unsigned char velocity) {
+unsigned rogueSynth::find_free_voice(uint part, unsigned char key, unsigned char velocity) {
     //take the next free voice if
     // ... notes are sustained but not this new one
     // ... notes are not sustained
-    if (data.playmode == POLY) {
-        for (uint i = 0; i < NVOICES; i++) {
-            if (voices[i]->get_key() == lvtk::INVALID_KEY) {
+    // parts at their voice limit steal from their own voices
+    if (parts[part].data.playmode == POLY) {
+        int same = key_voice[part * 128 + key];
+        if (*p(p_voice_steal) == SAME_KEY && same >= 0 && same < polyphony) {
+            return same;
+        }
+        if (parts[part].voices >= parts[part].max_voices) {
+            return steal_voice(part);
+        }
+        for (uint i = 0; i < polyphony; i++) {
+            if (!is_active[i]) {
                 return i;
             }
         }
+        return steal_voice(NPARTS);
+    }
+
+    // mono parts keep their voice while it plays for them, else they take
+    // one like a poly note
+    int v = parts[part].mono_voice;
+    if (v < 0 || !is_active[v] || voice_part[v] != part) {
+        v = -1;
+        for (uint i = 0; i < polyphony && v < 0; i++) {
+            if (!is_active[i]) {
+                v = i;
+            }
+        }
+        parts[part].mono_voice = v = v >= 0 ? v : steal_voice(NPARTS);
     }
+    return v;
+}
+
+unsigned rogueSynth::steal_voice(uint part) {
+    // from the given part or from all parts
+    const uint policy = *p(p_voice_steal);
+    int best = -1;
+    float best_value = 0.0f;
+    for (uint j = 0; j < active_count; j++) {
+        // lower is better, released voices are preferred by the
+        // released policy, age breaks ties
+        uint i = active[j];
+        if (part < NPARTS && voice_part[i] != part) {
+            continue;
+        }
+        float value = float(voice_age[i]);
+        if (policy == QUIETEST) {
+            value = voices[i]->level();
+        } else if (policy == RELEASED && !voices[i]->is_released()) {
+            value += float(notes);
+        }
+        if (best < 0 || value < best_value) {
+            best = i;
+            best_value = value;
+        }
+    }
+    if (best >= 0) {
+        return best;
+    } else if (part < NPARTS) {
+        // nothing of the part plays, steal from all parts
+        return steal_voice(NPARTS);
+    }
+    // with no active voices the first voice is free
+    return active_count > 0 ? active[0] : 0;
+}
+
+void rogueSynth::note_on(uint part, unsigned char key, unsigned char velocity) {
+    uint v = find_free_voice(part, key, velocity);
+    if (!is_active[v]) {
+        active[active_count++] = v;
+        is_active[v] = true;
+        parts[part].voices++;
+    } else if (voice_part[v] != part) {
+        parts[voice_part[v]].voices--;
+        parts[part].voices++;
+    }
+    rogueVoice* voice = voices[v];
+    bool playing = voice->get_key() != lvtk::INVALID_KEY;
+    voice->setPart(&parts[part].data);
+    if (playing && (parts[part].data.playmode == POLY || voice_part[v] != part)) {
+        voice->steal(key, velocity);
+    } else {
+        voice->on(key, velocity);
+    }
+    voice_part[v] = part;
+    voice_age[v] = notes++;
+    link(v, part * 128 + key);
+}
+
+void rogueSynth::note_off(uint part, unsigned char key, unsigned char velocity) {
+    int v = key_voice[part * 128 + key];
+    while (v >= 0) {
+        int next = voice_next[v];
+        if (voices[v]->get_key() == key) {
+            voices[v]->off(velocity);
+        } else {
+            unlink(v); // closed or taken by another key
+        }
+        v = next;
+    }
+}
 
-    return 0;
+void rogueSynth::link(uint voice, uint note) {
+    unlink(voice);
+    voice_next[voice] = key_voice[note];
+    key_voice[note] = voice;
+    voice_note[voice] = note;
+}
+
+void rogueSynth::unlink(uint voice) {
+    int note = voice_note[voice];
+    if (note < 0) {
+        return;
+    }
+    int* v = &key_voice[note];
+    while (*v >= 0 && *v != int(voice)) {
+        v = &voice_next[*v];
+    }
+    if (*v >= 0) {
+        *v = voice_next[voice];
+    }
+    voice_note[voice] = -1;
 }
 
 //parameter change
 void rogueSynth::update() {
-    // TODO scale dB parameters
-    data.bus_a_level = *p(p_bus_a_level); // scale
-    data.bus_a_pan   = *p(p_bus_a_pan);
-    data.bus_b_level = *p(p_bus_b_level); // scale
-    data.bus_b_pan   = *p(p_bus_b_pan);
-    data.volume      = *p(p_volume); // scale
-    data.playmode    = *p(p_play_mode);
-    data.glide_time  = *p(p_glide_time);
-    data.bend_range  = *p(p_pitchbend_range);
+    // changed voice ports go to the edit part, at first to all parts
+    multi = *p(p_multi_on) > 0.0f;
+    edit_part = multi ? std::min(uint(*p(p_edit_part)), uint(NPARTS - 1)) : 0;
+    const uint first = parts_ready ? edit_part : 0;
+    const uint last = parts_ready ? edit_part : NPARTS - 1;
+    for (uint i = 0; i < VOICE_PORTS; i++) {
+        if (*p(p_osc1_on + i) != voice_ports[i]) {
+            voice_ports[i] = *p(p_osc1_on + i);
+            for (uint j = first; j <= last; j++) {
+                parts[j].ports[i] = voice_ports[i];
+                parts[j].dirty = true;
+            }
+        }
+    }
+    if (*p(p_part_voices) != part_ports[0] || *p(p_part_send) != part_ports[1]) {
+        part_ports[0] = *p(p_part_voices);
+        part_ports[1] = *p(p_part_send);
+        for (uint j = first; j <= last; j++) {
+            parts[j].max_voices = std::max(1u, std::min(uint(part_ports[0]), uint(MAX_VOICES)));
+            parts[j].data.send = part_ports[1];
+        }
+    }
+    parts_ready = true;
+
+    // voices keep their cycle caches while the ports of their part are
+    // unchanged
+    for (uint j = 0; j < NPARTS; j++) {
+        if (parts[j].dirty) {
+            updatePart(parts[j]);
+            parts[j].data.version++;
+            parts[j].dirty = false;
+        }
+    }
+
+    // settings shared by all parts
+    volume           = *p(p_volume); // scale
+    growVoices();
+    polyphony        = std::max(1u, std::min(uint(*p(p_polyphony)), voice_count));
+    if (degradation >= HALF_VOICES) {
+        polyphony = std::max(1u, polyphony / 2);
+    }
+    growLanes();
+    // 8 to 64 samples, out of range values of the host are clamped
+    uint rate_index = uint(std::min(3.0f, std::max(0.0f, *p(p_control_rate))));
+    uint control_rate = std::min(8u << rate_index, uint(BUFFER_SIZE));
+    if (degradation >= SLOW_CONTROL) {
+        control_rate = std::min(2 * control_rate, uint(BUFFER_SIZE));
+    }
+    bypassing = false;
+    for (uint j = 0; j < NPARTS; j++) {
+        SynthData& d = parts[j].data;
+        d.playmode     = *p(p_play_mode);
+        d.glide_time   = *p(p_glide_time);
+        d.bend_range   = *p(p_pitchbend_range);
+        d.control_rate = control_rate;
+        bypassing |= d.send < 1.0f;
+    }
+
+    // tunings are swapped between periods, oscillators glide to the new
+    // frequencies within a control tick
+    int tuning = std::min(uint(*p(p_tuning)), uint(tunings.size() - 1));
+    if (tuning != tuning_index) {
+        for (uint j = 0; j < NPARTS; j++) {
+            parts[j].data.tuning = tunings[tuning];
+            parts[j].data.version++;
+        }
+        tuning_index = tuning;
+    }
+}
+
+rogueVoice* rogueSynth::newVoice() {
+    return new rogueVoice(sample_rate, &parts[0].data, left, right, 0, bypass_left, bypass_right, &voice_pool);
+}
+
+void rogueSynth::growVoices() {
+    // voices built by the worker can be taken once the job is done
+    if (voice_job.state.load(std::memory_order_acquire) == DONE) {
+        voice_count += voice_job.size;
+        voice_job.state = IDLE;
+    }
+
+    uint wanted = std::max(1u, std::min(uint(*p(p_polyphony)), uint(MAX_VOICES)));
+    if (wanted > voice_count && voice_job.state.load(std::memory_order_acquire) == IDLE) {
+        voice_job.first = voice_count;
+        voice_job.size = wanted - voice_count;
+        voice_job.state.store(PENDING, std::memory_order_release);
+        if (!worker.post(&voice_job)) {
+            voice_job.state = IDLE;
+        }
+    }
+}
+
+void rogueSynth::VoiceJob::work() {
+    // the slots after voice_count aren't read by the audio thread
+    for (uint i = first; i < first + size; i++) {
+        synth->voices[i] = synth->newVoice();
+    }
+    state.store(DONE, std::memory_order_release);
+}
+
+void rogueSynth::growLanes() {
+    // lanes allocated by the worker are added to the pool
+    if (lane_job.state.load(std::memory_order_acquire) == DONE) {
+        for (uint i = 0; i < lane_job.size; i++) {
+            voice_pool.lanes.give(&lane_job.lanes[i]);
+        }
+        lane_chunks[lane_chunk_count++] = lane_job.lanes;
+        lane_count += lane_job.size;
+        lane_job.state = IDLE;
+    }
+
+    uint unison = 1;
+    for (uint j = 0; j < (multi ? NPARTS : 1); j++) {
+        unison = std::max(unison, std::min(parts[j].data.unison, uint(MAX_UNISON)));
+    }
+    uint wanted = std::max(1u, std::min(uint(*p(p_polyphony)), uint(MAX_VOICES))) * (unison - 1);
+    if (wanted > lane_count && lane_job.state.load(std::memory_order_acquire) == IDLE) {
+        lane_job.size = wanted - lane_count;
+        lane_job.state.store(PENDING, std::memory_order_release);
+        if (!worker.post(&lane_job)) {
+            lane_job.state = IDLE;
+        }
+    }
+}
 
+void rogueSynth::LaneJob::work() {
+    // the lanes own their comb lines like the first lanes of the voices
+    lanes = new Lane[size];
+    for (uint i = 0; i < size; i++) {
+        lanes[i].setSamplerate(sample_rate);
+        lanes[i].setMemory(0);
+    }
+    state.store(DONE, std::memory_order_release);
+}
+
+void rogueSynth::updatePart(Part& part) {
+    SynthData& d = part.data;
     const float rate = sample_rate;
 
+    // TODO scale dB parameters
+    d.bus_a_level = part.port(p_bus_a_level); // scale
+    d.bus_a_pan   = part.port(p_bus_a_pan);
+    d.bus_b_level = part.port(p_bus_b_level); // scale
+    d.bus_b_pan   = part.port(p_bus_b_pan);
+    d.unison      = part.port(p_unison_voices);
+    d.unison_detune = part.port(p_unison_detune);
+    d.unison_spread = part.port(p_unison_spread);
+
     // XXX skip conf copying if element is off?
 
     // oscs
     for (uint i = 0; i < NOSC; i++) {
         uint off = i * OSC_OFF;
-        data.oscs[i].on          = *p(p_osc1_on + off);
-        data.oscs[i].type        = *p(p_osc1_type + off);
-        data.oscs[i].inv         = *p(p_osc1_inv + off);
-        data.oscs[i].free        = *p(p_osc1_free + off);
-        data.oscs[i].tracking    = *p(p_osc1_tracking + off);
-        data.oscs[i].ratio       = *p(p_osc1_ratio + off);
-        data.oscs[i].coarse      = *p(p_osc1_coarse + off);
-        data.oscs[i].fine        = *p(p_osc1_fine + off);
-        data.oscs[i].start       = *p(p_osc1_start + off);
-        data.oscs[i].width       = *p(p_osc1_width + off);
-        data.oscs[i].level_a     = *p(p_osc1_level_a + off); // scale
-        data.oscs[i].level_b     = *p(p_osc1_level_b + off); // scale
-        data.oscs[i].level       = *p(p_osc1_level + off);   // scale
-
-        data.oscs[i].input       = *p(p_osc1_input + off);
-        data.oscs[i].pm          = *p(p_osc1_pm + off);
-        data.oscs[i].sync        = *p(p_osc1_sync + off);
-        data.oscs[i].input2      = *p(p_osc1_input2 + off);
-        data.oscs[i].out_mod     = *p(p_osc1_out_mod + off);
+        d.oscs[i].on          = part.port(p_osc1_on + off);
+        d.oscs[i].type        = part.port(p_osc1_type + off);
+        d.oscs[i].inv         = part.port(p_osc1_inv + off);
+        d.oscs[i].free        = part.port(p_osc1_free + off);
+        d.oscs[i].tracking    = part.port(p_osc1_tracking + off);
+        d.oscs[i].ratio       = part.port(p_osc1_ratio + off);
+        d.oscs[i].coarse      = part.port(p_osc1_coarse + off);
+        d.oscs[i].fine        = part.port(p_osc1_fine + off);
+        d.oscs[i].start       = part.port(p_osc1_start + off);
+        d.oscs[i].width       = part.port(p_osc1_width + off);
+        d.oscs[i].level_a     = part.port(p_osc1_level_a + off); // scale
+        d.oscs[i].level_b     = part.port(p_osc1_level_b + off); // scale
+        d.oscs[i].level       = part.port(p_osc1_level + off);   // scale
+
+        d.oscs[i].input       = part.port(p_osc1_input + off);
+        d.oscs[i].pm          = part.port(p_osc1_pm + off);
+        d.oscs[i].sync        = part.port(p_osc1_sync + off);
+        d.oscs[i].input2      = part.port(p_osc1_input2 + off);
+        d.oscs[i].out_mod     = part.port(p_osc1_out_mod + off);
     }
 
     // filters
     for (uint i = 0; i < NDCF; i++) {
         uint off = i * DCF_OFF;
-        data.filters[i].on       = *p(p_filter1_on + off);
-        data.filters[i].type     = *p(p_filter1_type + off);
-        data.filters[i].source   = *p(p_filter1_source + off);
-        data.filters[i].freq     = *p(p_filter1_freq + off);
-        data.filters[i].q        = *p(p_filter1_q + off);
-        data.filters[i].distortion = *p(p_filter1_distortion + off);
-        data.filters[i].level    = *p(p_filter1_level + off); // scale
-        data.filters[i].pan      = *p(p_filter1_pan + off);
+        d.filters[i].on       = part.port(p_filter1_on + off);
+        d.filters[i].type     = part.port(p_filter1_type + off);
+        d.filters[i].source   = part.port(p_filter1_source + off);
+        d.filters[i].freq     = part.port(p_filter1_freq + off);
+        d.filters[i].q        = part.port(p_filter1_q + off);
+        d.filters[i].distortion = part.port(p_filter1_distortion + off);
+        d.filters[i].level    = part.port(p_filter1_level + off); // scale
+        d.filters[i].pan      = part.port(p_filter1_pan + off);
 
-        data.filters[i].key_to_f = *p(p_filter1_key_to_f + off);
-        data.filters[i].vel_to_f = *p(p_filter1_vel_to_f + off);
+        // cutoff factors of key and velocity tracking, computed when changed
+        FilterData& filterData = d.filters[i];
+        if (part.port(p_filter1_key_to_f + off) != filterData.key_to_f) {
+            filterData.key_to_f = part.port(p_filter1_key_to_f + off);
+            for (uint k = 0; k < 128; k++) {
+                filterData.key_scale[k] = std::pow(SEMITONE, filterData.key_to_f * (k - 69.0f));
+            }
+        }
+        if (part.port(p_filter1_vel_to_f + off) != filterData.vel_to_f) {
+            filterData.vel_to_f = part.port(p_filter1_vel_to_f + off);
+            for (uint v = 0; v < 128; v++) {
+                filterData.vel_scale[v] = std::pow(SEMITONE, filterData.vel_to_f * (v - 64.0f));
+            }
+        }
     }
 
     // lfos
     for (uint i = 0; i < NLFO; i++) {
         uint off = i * LFO_OFF;
-        data.lfos[i].on          = *p(p_lfo1_on + off);
-        data.lfos[i].type        = *p(p_lfo1_type + off);
-        data.lfos[i].inv         = *p(p_lfo1_inv + off);
-        data.lfos[i].reset_type  = *p(p_lfo1_reset_type + off);
-        data.lfos[i].freq        = *p(p_lfo1_freq + off);
-        data.lfos[i].start       = *p(p_lfo1_start + off);
-        data.lfos[i].width       = *p(p_lfo1_width + off);
-        data.lfos[i].humanize    = *p(p_lfo1_humanize + off);
+        d.lfos[i].on          = part.port(p_lfo1_on + off);
+        d.lfos[i].type        = part.port(p_lfo1_type + off);
+        d.lfos[i].inv         = part.port(p_lfo1_inv + off);
+        d.lfos[i].reset_type  = part.port(p_lfo1_reset_type + off);
+        d.lfos[i].freq        = part.port(p_lfo1_freq + off);
+        d.lfos[i].start       = part.port(p_lfo1_start + off);
+        d.lfos[i].width       = part.port(p_lfo1_width + off);
+        d.lfos[i].humanize    = part.port(p_lfo1_humanize + off);
     }
 
     // envs
     for (uint i = 0; i < NENV; i++) {
         uint off = i * ENV_OFF;
-        data.envs[i].on          = *p(p_env1_on + off);
-        data.envs[i].pre_delay   = *p(p_env1_pre_delay + off) * rate;
-        data.envs[i].attack      = *p(p_env1_attack + off) * rate;
-        data.envs[i].hold        = *p(p_env1_hold + off) * rate;
-        data.envs[i].decay       = *p(p_env1_decay + off) * rate;
-        data.envs[i].sustain     = *p(p_env1_sustain + off);
-        data.envs[i].release     = *p(p_env1_release + off) * rate;
-        data.envs[i].curve       = *p(p_env1_curve + off);
-        data.envs[i].retrigger   = *p(p_env1_retrigger + off);
+        d.envs[i].on          = part.port(p_env1_on + off);
+        d.envs[i].pre_delay   = part.port(p_env1_pre_delay + off) * rate;
+        d.envs[i].attack      = part.port(p_env1_attack + off) * rate;
+        d.envs[i].hold        = part.port(p_env1_hold + off) * rate;
+        d.envs[i].decay       = part.port(p_env1_decay + off) * rate;
+        d.envs[i].sustain     = part.port(p_env1_sustain + off);
+        d.envs[i].release     = part.port(p_env1_release + off) * rate;
+        d.envs[i].curve       = part.port(p_env1_curve + off);
+        d.envs[i].retrigger   = part.port(p_env1_retrigger + off);
+        d.envs[i].configure(d.envs[i].shape, 1.0f);
+        d.envs[i].shaped = true;
     }
 
     // mods
     int mod_count = 0;
+    std::fill(d.audio_sources, d.audio_sources + M_SIZE, false);
+    std::fill(d.audio_targets, d.audio_targets + M_TARGET_SIZE, false);
+    std::fill(d.targets, d.targets + M_TARGET_SIZE, false);
     for (uint i = 0; i < NMOD; i++) {
         uint off = i * MOD_OFF;
-        data.mods[i].src         = *p(p_mod1_src + off);
-        data.mods[i].target      = *p(p_mod1_target + off);
-        data.mods[i].amount      = *p(p_mod1_amount + off);
-        if (data.mods[i].src > 0 && data.mods[i].target > 0) {
+        // hosts may send values outside of the port ranges
+        d.mods[i].src         = std::min(uint(part.port(p_mod1_src + off)), uint(M_SIZE - 1));
+        d.mods[i].target      = std::min(uint(part.port(p_mod1_target + off)), uint(M_TARGET_SIZE - 1));
+        d.mods[i].amount      = part.port(p_mod1_amount + off);
+        d.mods[i].audio       = part.port(p_mod1_audio + off) > 0.0
+                                   && is_audio_source(d.mods[i].src)
+                                   && is_audio_target(d.mods[i].target);
+        if (d.mods[i].src > 0 && d.mods[i].target > 0) {
             mod_count = i + 1;
+            d.targets[d.mods[i].target] |= !d.mods[i].audio;
+        }
+        if (d.mods[i].audio) {
+            d.audio_sources[d.mods[i].src] = true;
+            d.audio_targets[d.mods[i].target] = true;
         }
     }
 
-    data.mod_count = mod_count;
+    d.mod_count = mod_count;
+}
+
+void rogueSynth::run(uint32_t sample_count) {
+    auto start = std::chrono::steady_clock::now();
+    period = std::max(period, uint(sample_count));
+    lvtk::Synth<rogueVoice, rogueSynth, lvtk::State<false> >::run(sample_count);
+    std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+    if (sample_count > 0) {
+        govern(elapsed.count() * sample_rate / sample_count, sample_count);
+    }
+}
+
+void rogueSynth::govern(float period_load, uint samples) {
+    // rises at once, falls with a time constant of half a second
+    if (period_load > load) {
+        load = period_load;
+    } else {
+        load += std::min(1.0f, samples / (0.5f * sample_rate)) * (period_load - load);
+    }
+    if (period_load > 0.9f) {
+        xrun_risk++;
+    }
+
+    // one level at a time, at most every 100ms up and every second down
+    since_change += samples;
+    below_low = load < *p(p_load_low) ? below_low + samples : 0;
+    if (*p(p_governor_on) == 0.0f) {
+        degradation = FULL;
+    } else if (load > *p(p_load_high) && degradation < HALF_VOICES && since_change > 0.1f * sample_rate) {
+        degradation++;
+        since_change = 0;
+    } else if (degradation > FULL && below_low > sample_rate && since_change > sample_rate) {
+        degradation--;
+        since_change = 0;
+    }
+
+    if (p(p_cpu_load)) {
+        *p(p_cpu_load) = load;
+        *p(p_degradation) = degradation;
+        *p(p_xrun_risk) = xrun_risk;
+    }
 }
 
 void rogueSynth::pre_process(uint from, uint to) {
     update();
 
-    from = data.oversample * from;
-    to = data.oversample * to;
+    from = oversample * from;
+    to = oversample * to;
 
     uint samples = to - from;
     std::memset(left + from, 0, sizeof(float) * samples);
     std::memset(right + from, 0, sizeof(float) * samples);
+    if (bypassing) {
+        std::memset(bypass_left + from, 0, sizeof(float) * samples);
+        std::memset(bypass_right + from, 0, sizeof(float) * samples);
+    }
 }
 
 void rogueSynth::post_process(uint from, uint to) {
@@ -171,84 +590,334 @@ void rogueSynth::post_process(uint from, uint to) {
 
     const uint samples = to - from;
 
+    // active voices, closed ones leave the list, under load quiet released
+    // voices are stopped early
+    uint count = 0;
+    for (uint i = 0; i < active_count; i++) {
+        uint v = active[i];
+        if (degradation >= EARLY_RELEASE && voices[v]->is_released() && voices[v]->level() < 0.01f) {
+            voices[v]->stop();
+        }
+        voices[v]->render(from, to);
+        if (voices[v]->get_key() != lvtk::INVALID_KEY) {
+            active[count++] = v;
+        } else {
+            is_active[v] = false;
+            parts[voice_part[v]].voices--;
+        }
+    }
+    active_count = count;
+
     // downsample
-    converter_data.data_in = left + (data.oversample * from);
-    converter_data.input_frames = data.oversample * samples;
+    converter_data.data_in = left + (oversample * from);
+    converter_data.input_frames = oversample * samples;
     converter_data.data_out = pleft;
     converter_data.output_frames = samples;
     src_process(converter_l, &converter_data);
 
-    converter_data.data_in = right + (data.oversample * from);
-    converter_data.input_frames = data.oversample * samples;
+    converter_data.data_in = right + (oversample * from);
+    converter_data.input_frames = oversample * samples;
     converter_data.data_out = pright;
     converter_data.output_frames = samples;
     src_process(converter_r, &converter_data);
 
+    // the bypassed output is downsampled into the oversampled buffers,
+    // which are no longer needed
+    float* bypass_l = 0;
+    float* bypass_r = 0;
+    if (bypassing) {
+        bypass_l = left + (oversample * from);
+        bypass_r = right + (oversample * from);
+
+        converter_data.data_in = bypass_left + (oversample * from);
+        converter_data.input_frames = oversample * samples;
+        converter_data.data_out = bypass_l;
+        converter_data.output_frames = samples;
+        src_process(converter_bl, &converter_data);
+
+        converter_data.data_in = bypass_right + (oversample * from);
+        converter_data.input_frames = oversample * samples;
+        converter_data.data_out = bypass_r;
+        converter_data.output_frames = samples;
+        src_process(converter_br, &converter_data);
+    }
+
     // shift global LFO phases
-    for (uint i = 0; i < NLFO; i++) {
-        if (data.lfos[i].reset_type == 1) {
-            float inc = data.lfos[i].freq / sample_rate;
-            float phase = data.lfos[i].phase;
-            phase = fmod(phase + samples * inc, 1.0f);
-            data.lfos[i].phase = phase;
-        }
-    }
-
-    // DC blocking
-    ldcBlocker.process(pleft, pleft, samples);
-    rdcBlocker.process(pright, pright, samples);
-
-    // chorus
-    if (*p(p_chorus_on) > 0.0) {
-        float d = *p(p_chorus_delay);
-        float a = *p(p_chorus_amount);
-        float r = *p(p_chorus_rate);
-        float de = *p(p_chorus_depth);
-        float fb = *p(p_chorus_feedback);
-    	chorus_fx.setCoefficients(d, a, r, de, fb);
-    	chorus_fx.process(pleft, pright, samples);
-    }
-    // phaser
-    if (*p(p_phaser_on) > 0.0) {
-    	float min_fr = *p(p_phaser_min_freq);
-    	float max_fr = *p(p_phaser_max_freq);
-    	float r = *p(p_phaser_rate);
-    	float de = *p(p_phaser_depth);
-    	float fb = *p(p_phaser_feedback);
-    	phaser_fx.setCoefficients(min_fr, max_fr, r, de, fb);
-    	phaser_fx.process(pleft, pright, samples);
-    }
-    // delay
-    if (*p(p_delay_on) > 0.0) {
-        float bpm = *p(p_delay_bpm);
-        float div_l = *p(p_delay_divider_l);
-        float div_r = *p(p_delay_divider_r);
-        float de = *p(p_delay_depth);
-        float fb = *p(p_delay_feedback);
-        float pp = *p(p_delay_pingpong);
-        float lc = *p(p_delay_lowcut);
-        float hc = *p(p_delay_highcut);
-        delay_fx.setCoefficients(bpm, div_l, div_r, de, fb, pp, lc, hc);
-        delay_fx.process(pleft, pright, samples);
-    }
-    // reverb
-    if (*p(p_reverb_on) > 0.0) {
-        float pd = *p(p_reverb_predelay);
-        float dc = *p(p_reverb_decay);
-        float lc = *p(p_reverb_lowcut);
-        float hc = *p(p_reverb_highcut);
-        float de = *p(p_reverb_depth);
-        reverb_fx.setCoefficients(pd, dc, lc, hc, de);
-        reverb_fx.process(pleft, pright, samples);
+    for (uint j = 0; j < NPARTS; j++) {
+        SynthData& d = parts[j].data;
+        for (uint i = 0; i < NLFO; i++) {
+            if (d.lfos[i].reset_type == 1) {
+                float inc = d.lfos[i].freq / sample_rate;
+                float phase = d.lfos[i].phase;
+                phase = fmod(phase + samples * inc, 1.0f);
+                d.lfos[i].phase = phase;
+            }
+        }
+    }
+
+    // switch between the pipelined and the direct effects chain once the
+    // worker is done with the effects, the block grows to the host period
+    // at a block boundary, the rest of the larger block starts silent
+    bool idle = job_state.load(std::memory_order_acquire) != PENDING;
+    bool pipeline = *p(p_fx_thread) > 0.0;
+    if (pipeline != pipelined && idle) {
+        std::fill(&fx_buffer[0][0], &fx_buffer[0][0] + 4 * FX_BLOCK_MAX, 0.0f);
+        fx_pos = 0;
+        pipelined = pipeline;
+    }
+    uint block = std::min(period, uint(FX_BLOCK_MAX));
+    if (block > fx_block && fx_pos == 0 && idle) {
+        for (uint c = 0; c < 4; c++) {
+            std::fill(fx_buffer[c] + fx_block, fx_buffer[c] + block, 0.0f);
+        }
+        fx_block = block;
+    }
+
+    // limiter, cleared when switched on
+    bool limit = *p(p_limiter_on) > 0.0;
+    if (limit && !limiting) {
+        limiter.clear();
+    }
+    limiting = limit;
+    if (limiting && *p(p_limiter_ceiling) != ceiling_db) {
+        ceiling_db = *p(p_limiter_ceiling);
+        limiter.setCoefficients(ceiling_db);
+    }
+
+    if (p(p_latency)) {
+        uint latency = (pipelined ? fx_block : 0) + (limiting ? limiter.latency() : 0);
+        *p(p_latency) = latency;
+    }
+
+    if (!pipelined) {
+        std::copy(p(p_chorus_on), p(p_chorus_on) + FX_PORTS, fx_ports);
+        updateChain();
+
+        // silence after all effect tails have decayed
+        bool asleep = dsp::is_silent(pleft, pright, samples);
+        if (bypassing) {
+            asleep &= dsp::is_silent(bypass_l, bypass_r, samples);
+        }
+        for (uint i = 0; i < chain_size && asleep; i++) {
+            asleep = chain[i]->asleep();
+        }
+        if (asleep && (!limiting || limiter.asleep())) {
+            std::fill(pleft, pleft + samples, 0.0f);
+            std::fill(pright, pright + samples, 0.0f);
+            return;
+        }
     }
 
-    // volume
-    for (uint i = 0; i < samples; i++) {
-        pleft[i] = data.volume * pleft[i];
-        pright[i] = data.volume * pright[i];
+    // DC blocking, effects, volume and limiter block by block, so that
+    // the block stays in cache across the stages
+    for (uint i = 0; i < samples; i += BUFFER_SIZE) {
+        const uint n = std::min(samples - i, uint(BUFFER_SIZE));
+        float* l = pleft + i;
+        float* r = pright + i;
+        if (pipelined) {
+            exchange(l, r, bypass_l ? bypass_l + i : 0, bypass_r ? bypass_r + i : 0, n);
+        } else {
+            runChain(l, r, n);
+            if (bypass_l) {
+                for (uint k = 0; k < n; k++) {
+                    l[k] += bypass_l[i + k];
+                    r[k] += bypass_r[i + k];
+                }
+            }
+        }
+        for (uint k = 0; k < n; k++) {
+            l[k] = volume * l[k];
+            r[k] = volume * r[k];
+        }
+        if (limiting) {
+            limiter.run(l, r, n);
+        }
     }
+}
 
-    // TODO limiter
+void rogueSynth::runChain(float* left, float* right, uint samples) {
+    ldcBlocker.process(left, left, samples);
+    rdcBlocker.process(right, right, samples);
+    for (uint j = 0; j < chain_size; j++) {
+        chain[j]->run(left, right, samples);
+    }
+}
+
+void rogueSynth::exchange(float* left, float* right, const float* bypass_l, const float* bypass_r, uint samples) {
+    uint i = 0;
+    while (i < samples) {
+        // a block runs late when the worker is still on the previous one,
+        // the chain is busy then and the block passes dry
+        if (fx_pos == 0) {
+            fx_late = job_state.load(std::memory_order_acquire) == PENDING;
+            if (fx_late) {
+                xrun_risk++;
+            }
+        }
+        uint n = std::min(samples - i, fx_block - fx_pos);
+        if (fx_late) {
+            if (bypass_l) {
+                for (uint k = 0; k < n; k++) {
+                    left[i + k] += bypass_l[i + k];
+                    right[i + k] += bypass_r[i + k];
+                }
+            }
+        } else {
+            // the buffer holds the processed previous block, its samples
+            // are replaced by the new input as they are read
+            for (uint k = 0; k < n; k++) {
+                float l = fx_buffer[0][fx_pos + k];
+                float r = fx_buffer[1][fx_pos + k];
+                fx_buffer[0][fx_pos + k] = left[i + k];
+                fx_buffer[1][fx_pos + k] = right[i + k];
+                left[i + k] = l;
+                right[i + k] = r;
+            }
+            if (bypass_l) {
+                std::copy(bypass_l + i, bypass_l + i + n, fx_buffer[2] + fx_pos);
+                std::copy(bypass_r + i, bypass_r + i + n, fx_buffer[3] + fx_pos);
+            } else {
+                std::fill(fx_buffer[2] + fx_pos, fx_buffer[2] + fx_pos + n, 0.0f);
+                std::fill(fx_buffer[3] + fx_pos, fx_buffer[3] + fx_pos + n, 0.0f);
+            }
+        }
+        fx_pos += n;
+        i += n;
+        if (fx_pos == fx_block) {
+            // the block is processed inline when it can't be posted
+            if (!fx_late) {
+                std::copy(p(p_chorus_on), p(p_chorus_on) + FX_PORTS, job_ports);
+                job_state.store(PENDING, std::memory_order_release);
+                if (!worker.post(&pipeline_job)) {
+                    work();
+                }
+            }
+            fx_pos = 0;
+        }
+    }
+}
+
+void rogueSynth::work() {
+    std::copy(job_ports, job_ports + FX_PORTS, fx_ports);
+    updateChain();
+    bool asleep = dsp::is_silent(fx_buffer[0], fx_buffer[1], fx_block);
+    for (uint i = 0; i < chain_size && asleep; i++) {
+        asleep = chain[i]->asleep();
+    }
+    if (asleep) {
+        std::fill(fx_buffer[0], fx_buffer[0] + fx_block, 0.0f);
+        std::fill(fx_buffer[1], fx_buffer[1] + fx_block, 0.0f);
+    } else {
+        for (uint i = 0; i < fx_block; i += BUFFER_SIZE) {
+            runChain(fx_buffer[0] + i, fx_buffer[1] + i, std::min(fx_block - i, uint(BUFFER_SIZE)));
+        }
+    }
+    // bypassed output of the parts
+    for (uint i = 0; i < fx_block; i++) {
+        fx_buffer[0][i] += fx_buffer[2][i];
+        fx_buffer[1][i] += fx_buffer[3][i];
+    }
+    job_state.store(IDLE, std::memory_order_release);
+}
+
+void rogueSynth::updateChain() {
+    // rebuild the chain when effects are switched or reordered
+    bool changed = false;
+    for (uint i = 0; i < NEFFECTS; i++) {
+        float on = (i == CONVOLUTION && ir_paths.empty()) ? 0.0f : fx(effects[i].on);
+        float order = fx(effects[i].order);
+        changed |= chain_ports[2 * i] != on || chain_ports[2 * i + 1] != order;
+        chain_ports[2 * i] = on;
+        chain_ports[2 * i + 1] = order;
+    }
+    if (changed) {
+        chain_size = 0;
+        for (uint pos = 0; pos < NEFFECTS; pos++) {
+            for (uint i = 0; i < NEFFECTS; i++) {
+                if (chain_ports[2 * i] > 0.0f && uint(chain_ports[2 * i + 1]) == pos) {
+                    chain[chain_size++] = effects[i].fx;
+                }
+            }
+        }
+        // effects with an order beyond the last position
+        for (uint i = 0; i < NEFFECTS; i++) {
+            if (chain_ports[2 * i] > 0.0f && uint(chain_ports[2 * i + 1]) >= NEFFECTS) {
+                chain[chain_size++] = effects[i].fx;
+            }
+        }
+    }
+
+    // coefficients of enabled effects, only on change
+    for (uint i = 0; i < NEFFECTS; i++) {
+        EffectSlot& slot = effects[i];
+        if (chain_ports[2 * i] == 0.0f) {
+            continue;
+        }
+        for (uint j = 0; j <= slot.last - slot.first; j++) {
+            float value = fx(slot.first + j);
+            slot.dirty |= slot.values[j] != value;
+            slot.values[j] = value;
+        }
+        if (slot.dirty) {
+            setCoefficients(i);
+            slot.dirty = false;
+        }
+    }
+}
+
+void rogueSynth::setCoefficients(uint effect) {
+    switch (effect) {
+    case CHORUS: {
+        float d = fx(p_chorus_delay);
+        float a = fx(p_chorus_amount);
+        float r = fx(p_chorus_rate);
+        float de = fx(p_chorus_depth);
+        float fb = fx(p_chorus_feedback);
+        uint t = fx(p_chorus_taps);
+        chorus_fx.setCoefficients(d, a, r, de, fb, t);
+        break;
+    }
+    case PHASER: {
+        float min_fr = fx(p_phaser_min_freq);
+        float max_fr = fx(p_phaser_max_freq);
+        float r = fx(p_phaser_rate);
+        float de = fx(p_phaser_depth);
+        float fb = fx(p_phaser_feedback);
+        uint st = fx(p_phaser_stages);
+        phaser_fx.setCoefficients(min_fr, max_fr, r, de, fb, st);
+        break;
+    }
+    case DELAY: {
+        float bpm = fx(p_delay_bpm);
+        float div_l = fx(p_delay_divider_l);
+        float div_r = fx(p_delay_divider_r);
+        float de = fx(p_delay_depth);
+        float fb = fx(p_delay_feedback);
+        float pp = fx(p_delay_pingpong);
+        float lc = fx(p_delay_lowcut);
+        float hc = fx(p_delay_highcut);
+        delay_fx.setCoefficients(bpm, div_l, div_r, de, fb, pp, lc, hc);
+        break;
+    }
+    case REVERB: {
+        float pd = fx(p_reverb_predelay);
+        float dc = fx(p_reverb_decay);
+        float lc = fx(p_reverb_lowcut);
+        float hc = fx(p_reverb_highcut);
+        float de = fx(p_reverb_depth);
+        reverb_fx.setCoefficients(pd, dc, lc, hc, de);
+        break;
+    }
+    case CONVOLUTION: {
+        int ir = std::min(uint(fx(p_conv_ir)), uint(ir_paths.size() - 1));
+        if (ir != ir_index) {
+            conv_fx.request(ir_paths[ir].c_str());
+            ir_index = ir;
+        }
+        conv_fx.setCoefficients(fx(p_conv_depth));
+        break;
+    }
+    }
 }
 
 void rogueSynth::handle_midi(uint size, unsigned char* data) {
@@ -258,30 +927,25 @@ void rogueSynth::handle_midi(uint size, unsigned char* data) {
         return;
     }
 
-    //receive on all channels
+    //receive on all channels, a part per channel in multi-timbral mode
+    const uint part = multi ? data[0] & 0x0f : 0;
+    SynthData& partData = parts[part].data;
     switch(data[0] & 0xf0) {
     case 0x80: //note off
-        for (uint i = 0; i < NVOICES; ++i) {
-            if (voices[i]->get_key() == data[1]) {
-                voices[i]->off(data[2]);
-           }
-        }
+        note_off(part, data[1], data[2]);
         break;
 
     case 0x90: //note on
         if (data[2] > 0) {
-            voices[ find_free_voice(data[1], data[2]) ]->on(data[1], data[2]);
+            note_on(part, data[1], data[2]);
         } else {
-            for (uint i = 0; i < NVOICES; ++i) {
-                if (voices[i]->get_key() == data[1]) {
-                    voices[i]->off(data[2]);
-                }
-            }
+            note_off(part, data[1], data[2]);
         }
         break;
 
     case 0xE0: // pitchbend
-        this->data.pitch_bend = this->data.bend_range * float(128 * data[2] + data[1] - 8192) / 8192.0;
+        partData.pitch_bend = partData.bend_range * float(128 * data[2] + data[1] - 8192) / 8192.0;
+        partData.version++;
         break;
 
     //controller
@@ -305,8 +969,11 @@ void rogueSynth::handle_midi(uint size, unsigned char* data) {
         case 0x78:
         //all notes off
         case 0x7b:
-            for (uint v = 0; v < NVOICES; v++) {
-                voices[v]->reset();
+            for (uint i = 0; i < active_count; i++) {
+                if (voice_part[active[i]] == part) {
+                    voices[active[i]]->reset();
+                    unlink(active[i]);
+                }
             }
             break;
 
@@ -318,6 +985,48 @@ void rogueSynth::handle_midi(uint size, unsigned char* data) {
     }
 }
 
+lvtk::StateStatus rogueSynth::save(lvtk::StateStore& store, uint32_t flags, const lvtk::FeatureVec& features) {
+    // the host saves the ports, the state has the ports of all parts,
+    // saving can run next to the audio thread so a port edit during it may
+    // be saved half applied
+    std::vector<float> state(STATE_SIZE);
+    std::copy(voice_ports, voice_ports + VOICE_PORTS, &state[0]);
+    std::copy(part_ports, part_ports + 2, &state[VOICE_PORTS]);
+    for (uint j = 0; j < NPARTS; j++) {
+        float* part = &state[(j + 1) * PART_STATE];
+        std::copy(parts[j].ports, parts[j].ports + VOICE_PORTS, part);
+        part[VOICE_PORTS] = parts[j].max_voices;
+        part[VOICE_PORTS + 1] = parts[j].data.send;
+    }
+    return store(state_parts, &state[0], sizeof(float) * STATE_SIZE, state_chunk, lvtk::STATE_IS_POD);
+}
+
+lvtk::StateStatus rogueSynth::restore(lvtk::StateRetrieve& retrieve, uint32_t flags, const lvtk::FeatureVec& features) {
+    size_t size = 0;
+    uint32_t type = 0;
+    const float* state = static_cast<const float*>(retrieve(state_parts, &size, &type));
+    if (!state) {
+        // older sessions, the ports set all parts
+        return lvtk::STATE_SUCCESS;
+    } else if (type != state_chunk || size != sizeof(float) * STATE_SIZE) {
+        return lvtk::STATE_ERR_BAD_TYPE;
+    }
+
+    // the ports restored by the host equal the last read ones, so they
+    // don't overwrite the edit part
+    std::copy(state, state + VOICE_PORTS, voice_ports);
+    std::copy(state + VOICE_PORTS, state + PART_STATE, part_ports);
+    for (uint j = 0; j < NPARTS; j++) {
+        const float* part = state + (j + 1) * PART_STATE;
+        std::copy(part, part + VOICE_PORTS, parts[j].ports);
+        parts[j].max_voices = std::max(1u, std::min(uint(part[VOICE_PORTS]), uint(MAX_VOICES)));
+        parts[j].data.send = part[VOICE_PORTS + 1];
+        parts[j].dirty = true;
+    }
+    parts_ready = true;
+    return lvtk::STATE_SUCCESS;
+}
+
 static int _ = rogueSynth::register_class(p_uri);
 
 }
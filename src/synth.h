@@ -16,32 +16,132 @@
 #include "voice.h"
 #include "rogue.gen"
 #include "effects.h"
+#include "convolution.h"
+#include "worker.h"
 
 #include <lvtk/synth.hpp>
+#include <lvtk/ext/state.hpp>
 #include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
 
 namespace rogue {
 
-class rogueSynth : public lvtk::Synth<rogueVoice, rogueSynth> {
+class rogueSynth : public lvtk::Synth<rogueVoice, rogueSynth, lvtk::State<false> > {
 
     enum {POLY, MONO, LEGATO};
+    enum {OLDEST, QUIETEST, SAME_KEY, RELEASED};
+    enum {CHORUS, PHASER, DELAY, REVERB, CONVOLUTION, NEFFECTS};
+    enum {IDLE, PENDING, DONE};
+    enum {FULL, EARLY_RELEASE, SLOW_CONTROL, HALF_VOICES};
+
+    // ports of the voice configuration, from p_osc1_on to p_volume
+    static const uint VOICE_PORTS = p_volume - p_osc1_on;
+    // saved state, the voice ports, the voice limit and the send as last
+    // read from the ports and of each part
+    static const uint PART_STATE = VOICE_PORTS + 2;
+    static const uint STATE_SIZE = (NPARTS + 1) * PART_STATE;
+    // effect ports, from p_chorus_on to p_conv_depth
+    static const uint FX_PORTS = p_conv_depth - p_chorus_on + 1;
+    // largest block of the effects pipeline, the oversampled buffers hold
+    // host periods up to this
+    static const uint FX_BLOCK_MAX = 4096;
+    // voices built with the synth, the worker builds the rest up to the
+    // polyphony
+    static const uint FIRST_VOICES = 8;
+
+    // effect with its ports, parameters are the ports first..last
+    struct EffectSlot {
+        dsp::Effect* fx;
+        uint on, order, first, last;
+        float values[16];
+        bool dirty;
+    };
+
+    // part of the multi-timbral mode with its own copy of the voice ports,
+    // port changes go to the edit part only, the copies of all parts are
+    // saved with the plugin state
+    struct Part {
+        SynthData data;
+        float ports[VOICE_PORTS] = {};
+        uint voices = 0, max_voices = MAX_VOICES;
+        int mono_voice = -1; // voice of the mono and legato modes
+        bool dirty = false;
+        float port(uint i) const { return ports[i - p_osc1_on]; }
+    };
 
   public:
     rogueSynth(double);
     ~rogueSynth();
 
-    unsigned find_free_voice(unsigned char, unsigned char);
+    unsigned find_free_voice(uint part, unsigned char key, unsigned char velocity);
+    unsigned steal_voice(uint part);
+    void note_on(uint part, unsigned char key, unsigned char velocity);
+    void note_off(uint part, unsigned char key, unsigned char velocity);
+    void link(uint voice, uint note);
+    void unlink(uint voice);
     void handle_midi(uint, unsigned char*);
     void pre_process(uint from, uint to);
     void post_process(uint from, uint to);
     void update();
+    rogueVoice* newVoice();
+    void growVoices();
+    void growLanes();
+    void updatePart(Part& part);
+    void updateChain();
+    void setCoefficients(uint effect);
+    void runChain(float* left, float* right, uint samples);
+    void exchange(float* left, float* right, const float* bypass_l, const float* bypass_r, uint samples);
+    void work();
+    void run(uint32_t sample_count);
+    void govern(float period_load, uint samples);
+    lvtk::StateStatus save(lvtk::StateStore& store, uint32_t flags, const lvtk::FeatureVec& features);
+    lvtk::StateStatus restore(lvtk::StateRetrieve& retrieve, uint32_t flags, const lvtk::FeatureVec& features);
 
   private:
     float sample_rate;
+    dsp::DelayMemory delay_memory;
     dsp::DCBlocker ldcBlocker, rdcBlocker;
-    rogueVoice *voices[NVOICES];
     bool sustain;
-    SynthData data;
+    uint oversample = SynthData().oversample;
+    float volume;
+    float voice_ports[VOICE_PORTS] = {};
+
+    // parts, only the first one plays unless the multi-timbral mode is on
+    Part parts[NPARTS];
+    bool multi = false, parts_ready = false;
+    uint edit_part = 0;
+    float part_ports[2] = {-1.0f, -1.0f};
+    LV2_URID state_parts, state_chunk;
+
+    // voice pool, only the active voices are rendered, voices up to
+    // voice_count are built
+    rogueVoice* voices[MAX_VOICES];
+    uint active[MAX_VOICES];
+    bool is_active[MAX_VOICES];
+    uint active_count = 0, polyphony = 1, voice_count = 0;
+
+    // lanes of unison voices after the first, the pool grows on the worker
+    // to the polyphony times the lanes of the widest part
+    VoicePool voice_pool;
+    Lane* lane_chunks[MAX_VOICES * (MAX_UNISON - 1)];
+    uint lane_chunk_count = 0, lane_count = 0;
+
+    // voices by note, a list per key of each part linked through voice_next
+    int key_voice[NPARTS * 128];
+    int voice_next[MAX_VOICES];
+    int voice_note[MAX_VOICES];
+    uint voice_part[MAX_VOICES];
+    uint voice_age[MAX_VOICES];
+    uint notes = 0;
+
+    // cpu load governor, the degradation level rises when the smoothed load
+    // crosses the high threshold and falls when it has stayed below the low
+    // threshold for a second
+    float load = 0.0f;
+    uint degradation = FULL, xrun_risk = 0;
+    uint since_change = 0, below_low = 0;
 
     SRC_STATE* converter_l;
     SRC_STATE* converter_r;
@@ -49,10 +149,72 @@ class rogueSynth : public lvtk::Synth<rogueVoice, rogueSynth> {
     float left[8192];
     float right[8192];
 
+    // share of the part outputs that bypasses the effects, added after them
+    SRC_STATE* converter_bl;
+    SRC_STATE* converter_br;
+    float bypass_left[8192];
+    float bypass_right[8192];
+    bool bypassing = false;
+
     dsp::ChorusEffect chorus_fx;
     dsp::PhaserEffect phaser_fx;
     dsp::DelayEffect  delay_fx;
     dsp::ReverbEffect reverb_fx;
+    dsp::ConvolutionReverb conv_fx;
+    dsp::Limiter limiter;
+    bool limiting = false;
+    float ceiling_db = 1.0f;
+
+    std::vector<std::string> ir_paths;
+    int ir_index = -1;
+
+    // equal temperament and the tunings of the bundle, loaded up front
+    std::vector<dsp::Tuning> tunings;
+    int tuning_index = -1;
+
+    // enabled effects in processing order
+    EffectSlot effects[NEFFECTS];
+    dsp::Effect* chain[NEFFECTS];
+    uint chain_size = 0;
+    float chain_ports[2 * NEFFECTS];
+    float fx_ports[FX_PORTS];
+    float fx(uint port) { return fx_ports[port - p_chorus_on]; }
+
+    // effects pipeline, the audio thread takes the block processed by the
+    // worker out of the buffer as it writes the next one in and hands the
+    // buffer back at block boundaries, the block follows the largest host
+    // period and is also the latency, the bypassed output is delayed along
+    // in the last two channels
+    bool pipelined = false, fx_late = false;
+    float fx_buffer[4][FX_BLOCK_MAX];
+    float job_ports[FX_PORTS];
+    uint fx_block = BUFFER_SIZE, fx_pos = 0, period = 0;
+    std::atomic<int> job_state;
+
+    struct PipelineJob : dsp::Worker::Job {
+        rogueSynth* synth;
+        void work() { synth->work(); }
+    } pipeline_job;
+
+    struct VoiceJob : dsp::Worker::Job {
+        rogueSynth* synth;
+        uint first, size;
+        std::atomic<int> state;
+        void work();
+    } voice_job;
+
+    struct LaneJob : dsp::Worker::Job {
+        float sample_rate;
+        uint size;
+        Lane* lanes;
+        std::atomic<int> state;
+        void work();
+    } lane_job;
+
+    // last members, their threads are stopped before the rest is
+    // destroyed, impulse responses load in the background
+    dsp::Worker loader;
+    dsp::Worker worker;
 };
 
 }
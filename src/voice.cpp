@@ -9,8 +9,6 @@
 
 #include "voice.h"
 
-#define SEMITONE 1.05946f
-
 namespace rogue {
 
 static float midi2f_values[256];
@@ -19,14 +17,11 @@ static float midi2f(unsigned char data) {
     return midi2f_values[data];
 }
 
-static float midi2hz(float key) {
-    return 8.177445f * std::pow(SEMITONE, key);
-}
-
 static uint init_values() {
     for (uint i = 0; i < 256; i++) {
         midi2f_values[i] = 0.007874f * float(i);
     }
+    return 0;
 }
 
 static uint _ = init_values();
@@ -41,29 +36,32 @@ static float limit(float v, float min, float max) {
     }
 }
 
-rogueVoice::rogueVoice(double rate, SynthData* d, float* l, float* r) {
-    data = d;
+// source for the mix when a bus or filter is off
+static const float silence[BUFFER_SIZE] = {};
+
+rogueVoice::rogueVoice(double rate, SynthData* d, float* l, float* r, dsp::DelayMemory* memory, float* bl, float* br, VoicePool* vp) {
+    data = next_data = d;
+    pool = vp;
     sample_rate = d->oversample * rate;
     half_sample_rate = 0.5f * rate;
     left = l;
     right = r;
+    bypass_left = bl;
+    bypass_right = br;
+    fade_length = 0.001f * sample_rate;
 
     // init elements
-    for (uint i = 0; i < NOSC; i++) oscs[i] = Osc();
-    for (uint i = 0; i < NDCF; i++) filters[i] = Filter();
     for (uint i = 0; i < NLFO; i++) lfos[i] = LFO();
     for (uint i = 0; i < NENV; i++) envs[i] = Env();
 
     // set sample rate
-    for (uint i = 0; i < NOSC; i++) oscs[i].setSamplerate(sample_rate);
-    for (uint i = 0; i < NDCF; i++) filters[i].setSamplerate(sample_rate);
+    first_lane.setSamplerate(sample_rate);
+    first_lane.setMemory(memory);
+    lanes[0] = &first_lane;
+    for (uint u = 1; u < MAX_UNISON; u++) lanes[u] = 0;
     for (uint i = 0; i < NLFO; i++) lfos[0].setSamplerate(sample_rate);
 
-    // set buffers
-    buffers[0] = bus_a;
-    buffers[1] = bus_b;
-    buffers[2] = filters[0].buffer;
-    buffers[3] = filters[1].buffer;
+    reset();
 }
 
 void rogueVoice::on(unsigned char key, unsigned char velocity) {
@@ -76,6 +74,15 @@ void rogueVoice::on(unsigned char key, unsigned char velocity) {
 
     unsigned char old_key = m_key;
 
+    // notes play with the data of their part
+    data = next_data;
+
+    // a retriggered voice leaves the cycle cache
+    if (cache_state == CACHED) {
+        cache_fade = fade_length;
+    }
+    cache_state = LIVE;
+
     // store key that turned this voice on (used in 'get_key')
     m_key = key;
     m_velocity = velocity;
@@ -92,6 +99,20 @@ void rogueVoice::on(unsigned char key, unsigned char velocity) {
         this->key = glide_target = key;
     }
 
+    // unison lanes, the lanes after the first are taken from the pool and
+    // given back when dropped, the note has fewer lanes when it runs out
+    uint lanes_before = unison;
+    uint lanes_wanted = std::max(1u, std::min(data->unison, uint(MAX_UNISON)));
+    while (unison > lanes_wanted && pool) {
+        unison--;
+        pool->lanes.give(lanes[unison]);
+        lanes[unison] = 0;
+    }
+    while (unison < lanes_wanted && pool && (lanes[unison] = pool->lanes.take())) {
+        lanes[unison]->reset();
+        unison++;
+    }
+
     // config
     for (uint i = 0; i < NLFO; i++) configLFO(i);
     for (uint i = 0; i < NENV; i++) configEnv(i);
@@ -101,18 +122,28 @@ void rogueVoice::on(unsigned char key, unsigned char velocity) {
     // trigger on
     for (uint i = 0; i < NLFO; i++) lfos[i].on();
     for (uint i = 0; i < NENV; i++) envs[i].on();
-    if (old_key == lvtk::INVALID_KEY || data->playmode == POLY) {
-        for (uint i = 0; i < NOSC; i++) {
-            if (!data->oscs[i].free) oscs[i].resetPhase();
+    for (uint i = 0; i < NOSC; i++) {
+        if (data->oscs[i].free) {
+            continue;
+        }
+        for (uint u = 0; u < unison; u++) {
+            if (old_key == lvtk::INVALID_KEY || data->playmode == POLY || u >= lanes_before) {
+                lanes[u]->oscs[i].resetPhase(data->oscs[i].type);
+            }
         }
     }
 
-    in_sustain = false;
+    released = false;
 }
 
 void rogueVoice::off(unsigned char velocity) {
     //std::cout << "off " << int(m_key) << " " << int(velocity) << std::endl;
 
+    if (fade > 0) {
+        pending_off = true;
+        return;
+    }
+
     // trigger off
     for (uint i = 0; i < NLFO; i++) lfos[i].off();
     for (uint i = 0; i < NENV; i++) envs[i].off();
@@ -121,7 +152,7 @@ void rogueVoice::off(unsigned char velocity) {
     //INVALID_KEY yet, because the release sound still needs to be
     //rendered.  m_key is finally set to INVALID_KEY by 'render' when
     //env < SILENCE
-    in_sustain = true;
+    released = true;
 }
 
 static float multiply_mod(float v, float amt, float mval) {
@@ -136,11 +167,32 @@ static float add_mod(float v, float amt, float mval) {
     return v + amt * mval;
 }
 
+// audio rate variants, mval is given as scale * mval[i] + offset
+
+static void multiply_mod_audio(float* v, float amt, float* mval, float scale, float offset, uint from, uint to) {
+    const float c0 = (amt > 0 ? 1.0f - amt : 1.0f) + amt * offset;
+    const float c1 = amt * scale;
+    for (uint i = from; i < to; i++) {
+        v[i] *= c0 + c1 * mval[i];
+    }
+}
+
+static void add_mod_audio(float* v, float amt, float* mval, float scale, float offset, uint from, uint to) {
+    const float c0 = amt * offset;
+    const float c1 = amt * scale;
+    for (uint i = from; i < to; i++) {
+        v[i] += c0 + c1 * mval[i];
+    }
+}
+
 template<class Function>
 float rogueVoice::modulate(float init, int target, Function fn) {
+    if (!data->targets[target]) {
+        return init;
+    }
     float v = init;
     for (uint i = 0; i < data->mod_count; i++) {
-        if (data->mods[i].target == target) {
+        if (data->mods[i].target == target && !data->mods[i].audio) {
             ModulationData& modData = data->mods[i];
             v = fn(v, modData.amount, mod[modData.src]);
         }
@@ -148,6 +200,34 @@ float rogueVoice::modulate(float init, int target, Function fn) {
     return v;
 }
 
+template<class Function>
+void rogueVoice::modulate(float init, float* v, int target, Function fn, uint from, uint to) {
+    for (uint i = from; i < to; i++) {
+        v[i] = init;
+    }
+    for (uint i = 0; i < data->mod_count; i++) {
+        if (data->mods[i].target == target && data->mods[i].audio) {
+            ModulationData& modData = data->mods[i];
+            float scale, offset;
+            float* in = audioSource(modData.src, scale, offset);
+            fn(v, modData.amount, in, scale, offset, from, to);
+        }
+    }
+}
+
+float* rogueVoice::audioSource(uint src, float& scale, float& offset) {
+    if (src >= M_LFO1_BI && src <= M_LFO4_UN) {
+        bool unipolar = (src - M_LFO1_BI) % 2;
+        scale = unipolar ? 0.5f : 1.0f;
+        offset = unipolar ? 0.5f : 0.0f;
+        return lfos[(src - M_LFO1_BI) / 2].buffer;
+    } else {
+        scale = 1.0f;
+        offset = 0.0f;
+        return envs[src - M_ENV1].buffer;
+    }
+}
+
 void rogueVoice::configLFO(uint i) {
     LFOData& lfoData = data->lfos[i];
     LFO& lfo = lfos[i];
@@ -172,15 +252,26 @@ void rogueVoice::configLFO(uint i) {
 void rogueVoice::runLFO(uint i, uint from, uint to) {
     LFOData& lfoData = data->lfos[i];
     LFO& lfo = lfos[i];
+    bool audio = data->audio_sources[M_LFO1_BI + 2*i] || data->audio_sources[M_LFO1_UN + 2*i];
     float v = 0.0f;
     if (lfoData.on) {
-        v = lfo.lfo.tick(to - from);
+        // amp modulation
+        float amp = modulate(1.0f, M_LFO1_AMP + 2 * i, multiply_mod);
         if (lfoData.inv) {
-            v *= -1.0f;
+            amp *= -1.0f;
         }
 
-        // amp modulation
-        v *= modulate(1.0f, M_LFO1_AMP + 2 * i, multiply_mod);
+        if (audio) {
+            lfo.lfo.process(lfo.buffer + from, to - from);
+            for (uint j = from; j < to; j++) {
+                lfo.buffer[j] *= amp;
+            }
+            v = lfo.buffer[to - 1];
+        } else {
+            v = amp * lfo.lfo.tick(to - from);
+        }
+    } else if (audio) {
+        std::memset(lfo.buffer + from, 0, sizeof(float) * (to - from));
     }
     // update mod values
     mod[M_LFO1_BI + 2*i] = v;
@@ -194,29 +285,39 @@ void rogueVoice::configEnv(uint i) {
     EnvData& envData = data->envs[i];
     Env& env = envs[i];
 
+    // without speed modulation the settings are copied from the shape of
+    // the part
+    if (envData.shaped && !data->targets[M_ENV1_S + 2 * i]) {
+        env.env.setSettings(envData.shape);
+        return;
+    }
+
     // NOTE: envelopes can't modulate each other's speed
     float f = modulate(1.0f, M_ENV1_S + 2 * i, add_mod);
     if (f < 0.0) f = 0.0;
-    float a = envData.attack / f;
-    float h = envData.hold / f;
-    float d = envData.decay / f;
-    float s = envData.sustain;
-    float r = envData.release / f;
-
-    env.env.setRetrigger(envData.retrigger);
-    env.env.setCurve(envData.curve);
-    env.env.setPredelay(envData.pre_delay / f);
-    env.env.setAHDSR(std::max(a, 0.001f), h, d, s, r);
+    envData.configure(env.env, f);
 }
 
 void rogueVoice::runEnv(uint i, uint from, uint to) {
     EnvData& envData = data->envs[i];
     Env& env = envs[i];
+    bool audio = M_ENV1 + i < M_SIZE && data->audio_sources[M_ENV1 + i];
     float v = 0.0f;
     if (envData.on) {
-        v = env.env.tick(to - from);
         // amp modulation
-        v *= modulate(1.0f, M_ENV1_AMP + 2 * i, multiply_mod);
+        float amp = modulate(1.0f, M_ENV1_AMP + 2 * i, multiply_mod);
+
+        if (audio) {
+            env.env.process(env.buffer + from, to - from);
+            for (uint j = from; j < to; j++) {
+                env.buffer[j] *= amp;
+            }
+            v = env.buffer[to - 1];
+        } else {
+            v = amp * env.env.tick(to - from);
+        }
+    } else if (audio) {
+        std::memset(env.buffer + from, 0, sizeof(float) * (to - from));
     }
     // update mod values
     mod[M_ENV1 + i] = v;
@@ -227,40 +328,88 @@ void rogueVoice::runEnv(uint i, uint from, uint to) {
 
 void rogueVoice::configOsc(uint i) {
     OscData& oscData = data->oscs[i];
-    Osc& osc = oscs[i];
 
-    osc.setStart(oscData.start);
+    // lanes start in phase and drift apart with the detune, spread start
+    // phases would cancel harmonics while the lanes are close in pitch
+    for (uint u = 0; u < unison; u++) {
+        lanes[u]->oscs[i].setStart(oscData.start);
+    }
+}
+
+float rogueVoice::oscFreq(uint i, float pmod) {
+    OscData& oscData = data->oscs[i];
+    // the key is tuned, transposition, bend and modulation are in equal
+    // tempered semitones
+    float f = 440.0;
+    if (oscData.tracking) {
+        f = data->tuning.freq(key) * dsp::cents_.linear(100.0f * (oscData.coarse + oscData.fine + data->pitch_bend + pmod));
+    } else if (pmod > 0.0f) {
+        f = 440.0f * dsp::cents_.linear(100.0f * pmod);
+    }
+    return f * oscData.ratio;
 }
 
 void rogueVoice::runOsc(uint i, uint from, uint to) {
     OscData& oscData = data->oscs[i];
-    Osc& osc = oscs[i];
     if (oscData.on) {
         uint samples = to - from;
+        const uint p_target = M_OSC1_P + 4 * i;
+        const uint w_target = M_OSC1_PWM + 4 * i;
+        const uint a_target = M_OSC1_AMP + 4 * i;
+        const bool audio_p = data->audio_targets[p_target];
+        const bool audio_w = data->audio_targets[w_target];
+        const bool audio_a = data->audio_targets[a_target];
+
         // pitch modulation
-        float f = 440.0;
-        float pmod = 48.0f * modulate(0.0f, M_OSC1_P + 4 * i, add_mod);
-        if (oscData.tracking) {
-            f = midi2hz(key + oscData.coarse + oscData.fine + data->pitch_bend + pmod);
-        } else if (pmod > 0.0f) {
-            f = midi2hz(69.0f + pmod);
-        }
-        f *= oscData.ratio;
+        float pmod = modulate(0.0f, p_target, add_mod);
+        float f = oscFreq(i, 48.0f * pmod);
 
         // pulse width modulation
-        float width = oscData.width + modulate(0.0f, M_OSC1_PWM + 4 * i, add_mod);
+        float width = oscData.width + modulate(0.0f, w_target, add_mod);
         width = limit(width, 0, 1);
 
+        // per sample pitch and pwm, shared by the lanes
+        if (audio_p) modulate(pmod, mod_a, p_target, add_mod_audio, from, to);
+        if (audio_w) modulate(width, mod_b, w_target, add_mod_audio, from, to);
+
         // process
-        if (i > 0) {
-            float* in = oscs[oscData.input].buffer + from;
-            float* sync = oscs[oscData.input].sync + from;
-            osc.setModulation(oscData.type, in, sync, oscData.pm, oscData.sync);
+        for (uint u = 0; u < unison; u++) {
+            Lane& lane = *lanes[u];
+            Osc& osc = lane.oscs[i];
+            float* in = lane.oscs[oscData.input].buffer;
+            float* sync = lane.oscs[oscData.input].sync;
+            float fl = lane_ratio[u] * f, wl = width;
+            float ff = osc.freq_prev;
+            if (ff < 0.0) ff = fl;
+            if (audio_p || audio_w) {
+                // processed in segments of MOD_STEP samples
+                const float f_start = ff;
+                const float w_start = osc.width_prev;
+                float wf = w_start;
+                float ft = ff, wt = wf;
+                for (uint j = from; j < to; j += MOD_STEP) {
+                    uint end = std::min(j + MOD_STEP, to);
+                    float pos = float(end - from) / float(samples);
+                    ft = audio_p ? lane_ratio[u] * oscFreq(i, 48.0f * mod_a[end - 1]) : f_start + pos * (fl - f_start);
+                    wt = audio_w ? limit(mod_b[end - 1], 0, 1) : w_start + pos * (width - w_start);
+                    if (i > 0) {
+                        osc.setModulation(oscData.type, in + j, sync + j, oscData.pm, oscData.sync);
+                    }
+                    osc.process(oscData.type, ff, ft, wf, wt, osc.buffer + j, osc.sync + j, end - j);
+                    ff = ft;
+                    wf = wt;
+                }
+                fl = ft;
+                wl = wt;
+            } else {
+                if (i > 0) {
+                    osc.setModulation(oscData.type, in + from, sync + from, oscData.pm, oscData.sync);
+                }
+                osc.process(oscData.type, ff, fl, osc.width_prev, width, osc.buffer + from, osc.sync + from, samples);
+            }
+            osc.width_prev = wl;
+            osc.freq_prev = fl;
         }
-        float ff = osc.freq_prev;
-        float ft = f;
-        if (ff < 0.0) ff = ft;
-        osc.process(oscData.type, ff, ft, osc.width_prev, width, osc.buffer + from, osc.sync + from, samples);
 
         // amp modulation
         float v = oscData.level;
@@ -268,115 +417,191 @@ void rogueVoice::runOsc(uint i, uint from, uint to) {
             v *= -1.0f;
         }
 
-        v *= modulate(1.0f, M_OSC1_AMP + 4 * i, multiply_mod);
-        float step = (v - osc.prev_level) / float(samples);
-        float l = osc.prev_level;
-        for (uint i = from; i < to; i++) {
-            osc.buffer[i] *= l;
-            l += step;
+        v *= modulate(1.0f, a_target, multiply_mod);
+        if (audio_a) {
+            modulate(v, mod_a, a_target, multiply_mod_audio, from, to);
         }
-        osc.prev_level = v;
-
-        // audio output modulation
-        if (oscData.out_mod > 0) {
-            float* in = oscs[oscData.input2].buffer;
-            switch (oscData.out_mod) {
-            case 1: // Add
-                for (uint i = from; i < to; i++) {
-                    osc.buffer[i] += in[i];
+        for (uint u = 0; u < unison; u++) {
+            Lane& lane = *lanes[u];
+            Osc& osc = lane.oscs[i];
+            if (audio_a) {
+                for (uint j = from; j < to; j++) {
+                    osc.buffer[j] *= mod_a[j];
                 }
-                break;
-            case 2: // RM
-                for (uint i = from; i < to; i++) {
-                    osc.buffer[i] *= in[i];
+                osc.prev_level = mod_a[to - 1];
+            } else {
+                float step = (v - osc.prev_level) / float(samples);
+                float l = osc.prev_level;
+                for (uint j = from; j < to; j++) {
+                    osc.buffer[j] *= l;
+                    l += step;
                 }
-                break;
-            case 3: // AM
-                for (uint i = from; i < to; i++) {
-                    osc.buffer[i] *= 0.5f * (in[i] + 1.0f);
+                osc.prev_level = v;
+            }
+
+            // audio output modulation
+            if (oscData.out_mod > 0) {
+                float* in = lane.oscs[oscData.input2].buffer;
+                switch (oscData.out_mod) {
+                case 1: // Add
+                    for (uint j = from; j < to; j++) {
+                        osc.buffer[j] += in[j];
+                    }
+                    break;
+                case 2: // RM
+                    for (uint j = from; j < to; j++) {
+                        osc.buffer[j] *= in[j];
+                    }
+                    break;
+                case 3: // AM
+                    for (uint j = from; j < to; j++) {
+                        osc.buffer[j] *= 0.5f * (in[j] + 1.0f);
+                    }
+                    break;
                 }
-                break;
             }
-        }
 
-        // copy to buffers
-        for (uint i = from; i < to; i++) {
-            bus_a[i] += oscData.level_a * osc.buffer[i];
-            bus_b[i] += oscData.level_b * osc.buffer[i];
+            // copy to buffers
+            for (uint j = from; j < to; j++) {
+                lane.bus_a[j] += oscData.level_a * osc.buffer[j];
+                lane.bus_b[j] += oscData.level_b * osc.buffer[j];
+            }
         }
-
-        osc.width_prev = width;
-        osc.freq_prev = f;
     }
 }
 
 void rogueVoice::configFilter(uint i) {
     FilterData& filterData = data->filters[i];
-    Filter& filter = filters[i];
 
-    float semitones = 0.0f;
-    // key to f
-    if (filterData.key_to_f != 0.0f) {
-        semitones += filterData.key_to_f * (key - 69.0);
+    // whole keys from the tables, gliding keys are computed
+    uint k = uint(key);
+    if (float(k) == key && k < 128) {
+        key_vel_to_f[i] = filterData.key_scale[k] * filterData.vel_scale[m_velocity & 127];
+    } else {
+        float semitones = filterData.key_to_f * (key - 69.0) + filterData.vel_to_f * (velocity - 64.0);
+        key_vel_to_f[i] = std::pow(SEMITONE, semitones);
     }
-    // vel to f
-    if (filterData.vel_to_f != 0.0f) {
-        semitones += filterData.vel_to_f * (velocity - 64.0);
+}
+
+float rogueVoice::filterFreq(float f, float fmod) {
+    if (fmod != 0.0) {
+        f *= std::pow(SEMITONE, 48.0 * fmod);
     }
-    if (semitones != 0.0f) {
-        filter.key_vel_to_f = std::pow(SEMITONE, semitones);
+    return limit(f, 30.0f, half_sample_rate);
+}
+
+void rogueVoice::processFilter(uint i, Filter& filter, float f, float q, float* input, float* output, uint samples) {
+    FilterData& filterData = data->filters[i];
+    uint type = filterData.type;
+    float d = filterData.distortion;
+    if (type < 11) {
+        // comb line is only held while the comb type is in use
+        filter.comb.release();
+    }
+    if (type < 6) {
+        filter.am.setType(type);
+        filter.am.setDistortion(d);
+        filter.am.setCoefficients(f, q);
+        filter.am.process(input, output, samples);
+    } else if (type == 6) {
+        filter.moog.setType(0);
+        filter.moog.setDistortion(d);
+        filter.moog.setCoefficients(f, q);
+        filter.moog.process(input, output, samples);
+    } else if (type < 11) {
+        filter.svf.setType(type - 7);
+        filter.svf.setDistortion(d);
+        filter.svf.setCoefficients(f, q);
+        filter.svf.process(input, output, samples);
     } else {
-        filter.key_vel_to_f = 1.0;
+        filter.comb.setDistortion(d);
+        filter.comb.setCoefficients(f, q);
+        filter.comb.process(input, output, samples);
     }
 }
 
 void rogueVoice::runFilter(uint i, uint from, uint to) {
     FilterData& filterData = data->filters[i];
-    Filter& filter = filters[i];
     if (filterData.on) {
         uint samples = to - from;
-        uint type = filterData.type;
-        float f = filterData.freq * filter.key_vel_to_f;
+        const uint f_target = M_DCF1_F + 4 * i;
+        const uint q_target = M_DCF1_Q + 4 * i;
+        const uint a_target = M_DCF1_AMP + 4 * i;
+        const bool audio_f = data->audio_targets[f_target];
+        const bool audio_q = data->audio_targets[q_target];
+        const bool audio_a = data->audio_targets[a_target];
+        float f = filterData.freq * key_vel_to_f[i];
 
         // freq modulation
-        float fmod = modulate(0.0f, M_DCF1_F + 4 * i, add_mod);
-        if (fmod != 0.0) {
-            f *= std::pow(SEMITONE, 48.0 * fmod);
-        }
-        f = limit(f, 30.0f, half_sample_rate);
+        float fmod = modulate(0.0f, f_target, add_mod);
 
         // res modulation
-        float q = filterData.q + modulate(0.0f, M_DCF1_Q + 4 * i, add_mod);
-        q = limit(q, 0, 1);
+        float q = filterData.q + modulate(0.0f, q_target, add_mod);
+
+        // per sample cutoff and resonance, shared by the lanes
+        if (audio_f) modulate(fmod, mod_a, f_target, add_mod_audio, from, to);
+        if (audio_q) modulate(q, mod_b, q_target, add_mod_audio, from, to);
 
         // process
-        float* source = buffers[filterData.source];
-        if (type < 6) {
-            filter.am.setType(type);
-            filter.am.setCoefficients(f, q);
-            filter.am.process(source + from, filter.buffer + from, samples);
-        } else if (type == 6) {
-            filter.moog.setType(0);
-            filter.moog.setCoefficients(f, q);
-            filter.moog.process(source + from, filter.buffer + from, samples);
-        } else if (type < 11) {
-            filter.svf.setType(type - 7);
-            filter.svf.setCoefficients(f, q);
-            filter.svf.process(source + from, filter.buffer + from, samples);
-        } else {
-            filter.comb.setCoefficients(f, q);
-            filter.comb.process(source + from, filter.buffer + from,samples);
+        for (uint u = 0; u < unison; u++) {
+            Filter& filter = lanes[u]->filters[i];
+            float* source = lanes[u]->buffers[filterData.source];
+            if (audio_f || audio_q) {
+                // processed in segments of MOD_STEP samples
+                for (uint j = from; j < to; j += MOD_STEP) {
+                    uint end = std::min(j + MOD_STEP, to);
+                    float fs = filterFreq(f, audio_f ? mod_a[end - 1] : fmod);
+                    float qs = limit(audio_q ? mod_b[end - 1] : q, 0, 1);
+                    processFilter(i, filter, fs, qs, source + j, filter.buffer + j, end - j);
+                }
+            } else {
+                processFilter(i, filter, filterFreq(f, fmod), limit(q, 0, 1), source + from, filter.buffer + from, samples);
+            }
         }
 
         // amp modulation
-        float v = modulate(1.0f, M_DCF1_AMP + 4 * i, multiply_mod);
-        float step = (v - filter.prev_level) / float(samples);
-        float l = filter.prev_level;
-        for (uint i = from; i < to; i++) {
-            filter.buffer[i] *= l;
-            l += step;
+        float v = modulate(1.0f, a_target, multiply_mod);
+        if (audio_a) {
+            modulate(v, mod_a, a_target, multiply_mod_audio, from, to);
+        }
+        for (uint u = 0; u < unison; u++) {
+            Filter& filter = lanes[u]->filters[i];
+            if (audio_a) {
+                for (uint j = from; j < to; j++) {
+                    filter.buffer[j] *= mod_a[j];
+                }
+                filter.prev_level = mod_a[to - 1];
+            } else {
+                float step = (v - filter.prev_level) / float(samples);
+                float l = filter.prev_level;
+                for (uint j = from; j < to; j++) {
+                    filter.buffer[j] *= l;
+                    l += step;
+                }
+                filter.prev_level = v;
+            }
         }
-        filter.prev_level = v;
+    } else {
+        for (uint u = 0; u < unison; u++) {
+            lanes[u]->filters[i].comb.release();
+        }
+    }
+}
+
+void rogueVoice::runLanes() {
+    // lanes are spread evenly over the detune range of a semitone up and
+    // down and over the stereo spread
+    if (unison == 1) {
+        lane_ratio[0] = 1.0f;
+        lane_pan[0] = 0.0f;
+        return;
+    }
+    float detune = limit(data->unison_detune + modulate(0.0f, M_UNISON_DETUNE, add_mod), 0, 1);
+    float spread = limit(data->unison_spread + modulate(0.0f, M_UNISON_SPREAD, add_mod), 0, 1);
+    for (uint u = 0; u < unison; u++) {
+        const float pos = 2.0f * float(u) / float(unison - 1) - 1.0f;
+        lane_ratio[u] = dsp::cents_.linear(100.0f * detune * pos);
+        lane_pan[u] = 0.5f * spread * pos;
     }
 }
 
@@ -399,91 +624,374 @@ void rogueVoice::render(uint from, uint to, uint off) {
         return;
     }
 
-    if (glide_step != 0.0f) {
-        key += (to - from) * glide_step;
-        // TODO use counter for this instead
-        if ((glide_step > 0.0 && key >= glide_target) ||
-            (glide_step < 0.0 && key <= glide_target)) {
-            key = glide_target;
-            glide_step = 0.0f;
+    // reset buses
+    for (uint u = 0; u < unison; u++) {
+        std::memset(lanes[u]->bus_a, 0, sizeof(float) * BUFFER_SIZE);
+        std::memset(lanes[u]->bus_b, 0, sizeof(float) * BUFFER_SIZE);
+    }
+
+    // run elements once per control tick
+    const uint rate = data->control_rate;
+    bool started = false;
+    uint start = from;
+    while (start < to) {
+        uint end = std::min(to, (start / rate + 1) * rate);
+        started = false;
+
+        if (glide_step != 0.0f) {
+            key += (end - start) * glide_step;
+            // TODO use counter for this instead
+            if ((glide_step > 0.0 && key >= glide_target) ||
+                (glide_step < 0.0 && key <= glide_target)) {
+                key = glide_target;
+                glide_step = 0.0f;
+            }
+        }
+
+        for (uint i = 0; i < NLFO; i++) runLFO(i, start, end);
+        for (uint i = 0; i < NENV; i++) runEnv(i, start, end);
+
+        // steady voices are played from the cycle cache
+        updateCache();
+        if (cache_state == CACHED) {
+            readCache(start, end);
+            output(start, end, off);
+        } else {
+            runLanes();
+            for (uint i = 0; i < NOSC; i++) runOsc(i, start, end);
+            for (uint i = 0; i < NDCF; i++) runFilter(i, start, end);
+            // the crossfade from the cache changes the mix before the output
+            const bool fused = cache_fade == 0;
+            mix(start, end, off, fused);
+            trackCache(start, end);
+            if (!fused) {
+                output(start, end, off);
+            }
         }
+
+        // start the pending note once the stolen one has faded out
+        if (fade > 0) {
+            fade -= std::min(fade, end - start);
+            if (fade == 0) {
+                unsigned char k = pending_key, v = pending_velocity;
+                bool note_off = pending_off;
+                reset();
+                if (k == lvtk::INVALID_KEY) {
+                    return; // stopped
+                }
+                on(k, v);
+                if (note_off) {
+                    this->off(0);
+                }
+                started = true;
+            }
+        }
+
+        start = end;
     }
 
-    // reset buses
-    std::memset(bus_a, 0, sizeof(float) * BUFFER_SIZE);
-    std::memset(bus_b, 0, sizeof(float) * BUFFER_SIZE);
-
-    // run elements
-    for (uint i = 0; i < NLFO; i++) runLFO(i, from, to);
-    for (uint i = 0; i < NENV; i++) runEnv(i, from, to);
-    for (uint i = 0; i < NOSC; i++) runOsc(i, from, to);
-    for (uint i = 0; i < NDCF; i++) runFilter(i, from, to);
-
-    // TODO bus a pan modulation
-    // TODO bus b pan modulation
-    // TODO filter1 pan modulation
-    // TODO filter2 pan modulation
-
-    // amp modulation
-    const float e_start = envs[0].last;
-    const float e_step = (envs[0].current - e_start) / float(to - from);
-    float e_vol = e_start;
-
-    // bus a
-    if (data->bus_a_level > SILENCE) {
-        float l = data->bus_a_level * (1.0f - data->bus_a_pan);
-        float r = data->bus_a_level * data->bus_a_pan;
+    // close voice, if too silent, unless its note started after the last
+    // envelope tick
+    if (envs[0].current < SILENCE && fade == 0 && !started) {
+        reset();
+    }
+}
+
+void rogueVoice::steal(unsigned char key, unsigned char velocity) {
+    // the voice reports the new key already, so that note offs reach it
+    if (fade == 0) {
+        fade = fade_length;
+    }
+    m_key = pending_key = key;
+    pending_velocity = velocity;
+    pending_off = false;
+}
+
+void rogueVoice::stop() {
+    // fades out like a stolen voice, but without a pending note
+    if (fade == 0) {
+        fade = fade_length;
+    }
+    pending_key = lvtk::INVALID_KEY;
+    pending_off = false;
+}
+
+void rogueVoice::mix(uint from, uint to, uint off, bool out) {
+    // levels with the constant power pan law, sources that are off are
+    // mixed from a silent buffer
+    const float pans[4] = {
+        data->bus_a_pan + modulate(0.0f, M_BUSA_PAN, add_mod),
+        data->bus_b_pan + modulate(0.0f, M_BUSB_PAN, add_mod),
+        data->filters[0].pan + modulate(0.0f, M_DCF1_PAN, add_mod),
+        data->filters[1].pan + modulate(0.0f, M_DCF2_PAN, add_mod)};
+    const float levels[4] = {
+        data->bus_a_level,
+        data->bus_b_level,
+        data->filters[0].on ? data->filters[0].level : 0.0f,
+        data->filters[1].on ? data->filters[1].level : 0.0f};
+    // lanes are summed at equal power
+    const float lane_level = unison > 1 ? 1.0f / sqrtf(float(unison)) : 1.0f;
+
+    float e_start, e_step;
+    ampEnvelope(from, to, e_start, e_step);
+    const bool bypass = data->send < 1.0f && bypass_left;
+    const float send = bypass ? data->send : 1.0f;
+
+    const float inv = 1.0f / float(to - from);
+    for (uint u = 0; u < unison; u++) {
+        Lane& lane = *lanes[u];
+        const float* sources[4] = {lane.bus_a, lane.bus_b, lane.filters[0].buffer, lane.filters[1].buffer};
+
+        // gains ramped from the previous tick
+        float gl[4], gr[4], dl[4], dr[4];
+        for (uint s = 0; s < 4; s++) {
+            float level = levels[s] > SILENCE ? lane_level * levels[s] : 0.0f;
+            float pan = limit(pans[s] + lane_pan[u], 0.0f, 1.0f);
+            if (level == 0.0f) {
+                sources[s] = silence;
+            }
+            gl[s] = lane.mix_gain[s][0];
+            gr[s] = lane.mix_gain[s][1];
+            if (level != lane.mix_level[s] || pan != lane.mix_pan[s]) {
+                lane.mix_level[s] = level;
+                lane.mix_pan[s] = pan;
+                lane.mix_gain[s][0] = level * cosf(pan * float(M_PI_2));
+                lane.mix_gain[s][1] = level * sinf(pan * float(M_PI_2));
+            }
+            dl[s] = (lane.mix_gain[s][0] - gl[s]) * inv;
+            dr[s] = (lane.mix_gain[s][1] - gr[s]) * inv;
+        }
+
+        // all sources of the lane in one pass, the last lane applies the
+        // amp envelope and the effects send on the way out
+        const bool first = u == 0, last = out && u + 1 == unison;
         for (uint i = from; i < to; i++) {
-            float sample = e_vol * bus_a[i];
-            left[off + i]  += l * sample;
-            right[off + i] += r * sample;
-            e_vol += e_step;
+            const float t = float(i - from);
+            float l = 0.0f, r = 0.0f;
+            for (uint s = 0; s < 4; s++) {
+                l += (gl[s] + t * dl[s]) * sources[s][i];
+                r += (gr[s] + t * dr[s]) * sources[s][i];
+            }
+            if (!first) {
+                l += dry[0][i];
+                r += dry[1][i];
+            }
+            dry[0][i] = l;
+            dry[1][i] = r;
+            if (last) {
+                const float e = e_start + t * e_step;
+                l *= e;
+                r *= e;
+                left[off + i]  += send * l;
+                right[off + i] += send * r;
+                if (bypass) {
+                    bypass_left[off + i]  += l - send * l;
+                    bypass_right[off + i] += r - send * r;
+                }
+            }
         }
-        e_vol = e_start;
     }
+}
+
+void rogueVoice::ampEnvelope(uint from, uint to, float& start, float& step) {
+    // amp envelope, interpolated between control ticks
+    float e_start = envs[0].last, e_end = envs[0].current;
+    if (fade > 0) {
+        e_start *= float(fade) / float(fade_length);
+        e_end *= float(fade - std::min(fade, to - from)) / float(fade_length);
+    }
+    start = e_start;
+    step = (e_end - e_start) / float(to - from);
+}
 
-    // bus b
-    if (data->bus_b_level > SILENCE) {
-        float l = data->bus_b_level * (1.0f - data->bus_b_pan);
-        float r = data->bus_b_level * data->bus_b_pan;
+void rogueVoice::output(uint from, uint to, uint off) {
+    float e_start, e_step;
+    ampEnvelope(from, to, e_start, e_step);
+
+    if (data->send < 1.0f && bypass_left) {
+        // the rest of the effects send bypasses the effects
+        const float send = data->send;
         for (uint i = from; i < to; i++) {
-            float sample = e_vol * bus_b[i];
-            left[off + i]  += l * sample;
-            right[off + i] += r * sample;
-            e_vol += e_step;
+            const float e = e_start + float(i - from) * e_step;
+            const float l = e * dry[0][i], r = e * dry[1][i];
+            left[off + i]  += send * l;
+            right[off + i] += send * r;
+            bypass_left[off + i]  += l - send * l;
+            bypass_right[off + i] += r - send * r;
         }
-        e_vol = e_start;
+        return;
+    }
+    for (uint i = from; i < to; i++) {
+        const float e = e_start + float(i - from) * e_step;
+        left[off + i]  += e * dry[0][i];
+        right[off + i] += e * dry[1][i];
     }
+}
 
-    // filter 1
-    if (data->filters[0].on && data->filters[0].level > SILENCE) {
-        float l = data->filters[0].level * (1.0f - data->filters[0].pan);
-        float r = data->filters[0].level * data->filters[0].pan;
-        for (uint i = from; i < to; i++) {
-            float sample = e_vol * filters[0].buffer[i];
-            left[off + i]  += l * sample;
-            right[off + i] += r * sample;
-            e_vol += e_step;
+bool rogueVoice::steady() {
+    // no glide, no configuration changes and only constant modulation
+    // sources, the amp envelope is applied after the cache
+    if (glide_step != 0.0f || data->version != cache_version) {
+        return false;
+    }
+    for (uint i = 0; i < data->mod_count; i++) {
+        uint src = data->mods[i].src;
+        if (src == 0 || data->mods[i].target == 0) {
+            continue;
+        } else if (src >= M_LFO1_BI && src <= M_LFO4_UN) {
+            return false;
+        } else if (src >= M_ENV1 && src <= M_ENV4) {
+            uint e = src - M_ENV1;
+            if (data->envs[e].on && !envs[e].env.sustaining()) {
+                return false;
+            }
         }
-        e_vol = e_start;
     }
+    // super waves and noise don't repeat
+    for (uint i = 0; i < NOSC; i++) {
+        if (data->oscs[i].on && data->oscs[i].type >= 32) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    // filter 2
-    if (data->filters[1].on && data->filters[1].level > SILENCE) {
-        float l = data->filters[1].level * (1.0f - data->filters[1].pan);
-        float r = data->filters[1].level * data->filters[1].pan;
-        for (uint i = from; i < to; i++) {
-            float sample = e_vol * filters[1].buffer[i];
-            left[off + i]  += l * sample;
-            right[off + i] += r * sample;
-            e_vol += e_step;
+bool rogueVoice::loopLength() {
+    // common fundamental of the oscillators of all lanes, at most two
+    // octaves below the lowest one
+    float lowest = 0.0f;
+    for (uint u = 0; u < unison; u++) {
+        for (uint i = 0; i < NOSC; i++) {
+            if (data->oscs[i].on) {
+                float f = lanes[u]->oscs[i].freq_prev;
+                if (f <= 0.0f) {
+                    return false;
+                }
+                lowest = lowest > 0.0f ? std::min(lowest, f) : f;
+            }
         }
-        e_vol = e_start;
+    }
+    if (lowest == 0.0f) {
+        return false;
+    }
+    float base = 0.0f;
+    for (uint k = 1; k <= 4 && base == 0.0f; k++) {
+        base = lowest / float(k);
+        for (uint j = 0; j < unison * NOSC && base > 0.0f; j++) {
+            float ratio = lanes[j / NOSC]->oscs[j % NOSC].freq_prev / base;
+            if (data->oscs[j % NOSC].on && fabsf(ratio - roundf(ratio)) > 1e-4f * ratio) {
+                base = 0.0f;
+            }
+        }
+    }
+    if (base == 0.0f) {
+        return false;
     }
 
-    // close voice, if too silent
-    if (envs[0].current < SILENCE) {
-        reset();
+    // whole periods that come closest to a whole number of samples
+    const float period = sample_rate / base;
+    if (period < 2.0f || period > float(CACHE_SIZE)) {
+        return false;
+    }
+    cache_shift = 1.0f;
+    for (uint n = 1; n * period <= float(CACHE_SIZE); n++) {
+        float length = float(n) * period;
+        float shift = fabsf(length - roundf(length));
+        if (shift < cache_shift) {
+            cache_shift = shift;
+            cache_length = uint(roundf(length));
+        }
+    }
+    return cache_length > 0 && cache_length <= uint(CACHE_SIZE);
+}
+
+void rogueVoice::updateCache() {
+    if (cache_state == LIVE) {
+        cache_version = data->version;
+        cache_tries = 0;
+        if (steady()) {
+            cache_state = SETTLE;
+            cache_count = 0;
+        }
+    } else if (!steady()) {
+        if (cache_state == CACHED) {
+            cache_fade = fade_length; // crossfade from the loop to the live voice
+        }
+        cache_state = LIVE;
+    }
+}
+
+void rogueVoice::trackCache(uint from, uint to) {
+    // crossfade from the loop after leaving the cache
+    for (uint i = from; i < to && cache_fade > 0; i++, cache_fade--) {
+        const float w = float(cache_fade) / float(fade_length);
+        dry[0][i] += w * (cache->buffer[0][cache_pos] - dry[0][i]);
+        dry[1][i] += w * (cache->buffer[1][cache_pos] - dry[1][i]);
+        cache_pos = cache_pos + 1 < cache_length ? cache_pos + 1 : 0;
+    }
+
+    // the block goes back to the pool when no loop is recorded or played
+    if (cache && pool && cache_fade == 0 && (cache_state == LIVE || cache_state == SETTLE || cache_state == UNCACHEABLE)) {
+        pool->caches.give(cache);
+        cache = 0;
+    }
+
+    if (cache_state == SETTLE) {
+        // filters settle before the loop is recorded
+        cache_count += to - from;
+        if (cache_count >= 0.02f * sample_rate) {
+            // voices are uncacheable while the pool has no free block
+            bool loop = loopLength();
+            if (loop && !cache && pool) {
+                cache = pool->caches.take();
+            }
+            cache_state = loop && cache ? RECORD : UNCACHEABLE;
+            cache_pos = 0;
+            cache_peak = cache_step = 0.0f;
+        }
+        return;
+    }
+
+    for (uint i = from; i < to; i++) {
+        const float l = dry[0][i], r = dry[1][i];
+        if (cache_state == RECORD) {
+            if (cache_pos > 0) {
+                cache_step = std::max(cache_step, std::max(fabsf(l - cache->buffer[0][cache_pos - 1]), fabsf(r - cache->buffer[1][cache_pos - 1])));
+            }
+            cache_peak = std::max(cache_peak, std::max(fabsf(l), fabsf(r)));
+            cache->buffer[0][cache_pos] = l;
+            cache->buffer[1][cache_pos] = r;
+            if (++cache_pos == cache_length) {
+                cache_state = VERIFY;
+                cache_pos = 0;
+                cache_error = 0.0f;
+            }
+        } else if (cache_state == VERIFY) {
+            // the next loop has to match the recorded one, up to the
+            // shift of its length against the period
+            cache_error = std::max(cache_error, std::max(fabsf(l - cache->buffer[0][cache_pos]), fabsf(r - cache->buffer[1][cache_pos])));
+            if (++cache_pos == cache_length) {
+                cache_pos = 0;
+                if (cache_error <= (2.0f * cache_shift + 0.01f) * cache_step + 1e-4f * cache_peak) {
+                    cache_state = CACHED;
+                } else {
+                    cache_state = ++cache_tries < 3 ? RECORD : UNCACHEABLE;
+                    cache_peak = cache_step = 0.0f;
+                }
+            }
+        } else if (cache_state == CACHED) {
+            cache_pos = cache_pos + 1 < cache_length ? cache_pos + 1 : 0;
+        }
+    }
+}
+
+void rogueVoice::readCache(uint from, uint to) {
+    for (uint i = from; i < to; ) {
+        uint n = std::min(to - i, cache_length - cache_pos);
+        std::copy(cache->buffer[0] + cache_pos, cache->buffer[0] + cache_pos + n, dry[0] + i);
+        std::copy(cache->buffer[1] + cache_pos, cache->buffer[1] + cache_pos + n, dry[1] + i);
+        cache_pos = cache_pos + n < cache_length ? cache_pos + n : 0;
+        i += n;
     }
 }
 
@@ -493,13 +1001,25 @@ void rogueVoice::reset() {
     m_key = lvtk::INVALID_KEY;
 
     key = m_key;
-    in_sustain = false;
+    released = false;
+    fade = 0;
+    pending_off = false;
+    cache_state = LIVE;
+    cache_fade = 0;
+    if (cache && pool) {
+        pool->caches.give(cache);
+        cache = 0;
+    }
     std::memset(mod, 0, sizeof(float) * M_SIZE);
 
     for (uint i = 0; i < NLFO; i++) lfos[i].reset();
     for (uint i = 0; i < NENV; i++) envs[i].reset();
-    for (uint i = 0; i < NOSC; i++) oscs[i].reset();
-    for (uint i = 0; i < NDCF; i++) filters[i].reset();
+    for (uint u = 1; u < unison && pool; u++) {
+        pool->lanes.give(lanes[u]);
+        lanes[u] = 0;
+    }
+    unison = 1;
+    first_lane.reset();
 }
 
 
@@ -21,22 +21,49 @@ namespace rogue {
 class rogueVoice : public lvtk::Voice {
 
     enum {POLY, MONO, LEGATO};
+    enum {LIVE, SETTLE, RECORD, VERIFY, CACHED, UNCACHEABLE};
+
+    static const uint CACHE_SIZE = Cache::SIZE;
 
     private:
       SynthData* data;
-      Osc oscs[NOSC];
-      Filter filters[NDCF];
+      SynthData* next_data; // data of the part of the next note
+      VoicePool* pool;
+      Lane first_lane;
       LFO lfos[NLFO];
       Env envs[NENV];
 
       float glide_target;
-      float* buffers[4];
-      float bus_a[BUFFER_SIZE], bus_b[BUFFER_SIZE];
       float mod[M_SIZE];
-      bool in_sustain = false;
+      float mod_a[BUFFER_SIZE], mod_b[BUFFER_SIZE]; // audio rate target values
+      bool released = false; // key is off, the release is playing
+
+      // unison lanes of the note, the first lane and the ones taken from
+      // the pool, their frequency ratios and pan offsets
+      Lane* lanes[MAX_UNISON];
+      uint unison = 1;
+      float lane_ratio[MAX_UNISON], lane_pan[MAX_UNISON];
+      float key_vel_to_f[NDCF];
 
       float* left;
       float* right;
+      // output that bypasses the effects, by the effects send of the part
+      float* bypass_left;
+      float* bypass_right;
+
+      // stolen and stopped voices fade out before the pending note starts
+      uint fade = 0, fade_length;
+      unsigned char pending_key, pending_velocity;
+      bool pending_off = false;
+
+      // cycle cache, while the voice is steady a loop of whole periods of
+      // its output before the amp envelope is recorded into a block of the
+      // pool and played back
+      float dry[2][BUFFER_SIZE];
+      Cache* cache = 0;
+      uint cache_state = LIVE, cache_version = 0, cache_tries = 0;
+      uint cache_length = 0, cache_pos = 0, cache_count = 0, cache_fade = 0;
+      float cache_shift, cache_step, cache_peak, cache_error;
 
     protected:
       float sample_rate;
@@ -47,6 +74,14 @@ class rogueVoice : public lvtk::Voice {
       template<class Function>
       float modulate(float init, int target, Function fn);
 
+      template<class Function>
+      void modulate(float init, float* v, int target, Function fn, uint from, uint to);
+
+      float* audioSource(uint src, float& scale, float& offset);
+      float oscFreq(uint i, float pmod);
+      float filterFreq(float f, float fmod);
+      void processFilter(uint i, Filter& filter, float f, float q, float* input, float* output, uint samples);
+
       // configure
       void configLFO(uint i);
       void configEnv(uint i);
@@ -56,17 +91,32 @@ class rogueVoice : public lvtk::Voice {
       // run
       void runLFO(uint i, uint from, uint to);
       void runEnv(uint i, uint from, uint to);
+      void runLanes();
       void runOsc(uint i, uint from, uint to);
       void runFilter(uint i, uint from, uint to);
+      void mix(uint from, uint to, uint off, bool out);
+      void ampEnvelope(uint from, uint to, float& start, float& step);
+      void output(uint from, uint to, uint off);
+
+      // cycle cache
+      bool steady();
+      bool loopLength();
+      void updateCache();
+      void trackCache(uint from, uint to);
+      void readCache(uint from, uint to);
 
       void render(uint, uint, uint off);
 
     public:
-      rogueVoice(double, SynthData*, float*, float*);
+      rogueVoice(double, SynthData*, float*, float*, dsp::DelayMemory* memory = 0, float* bl = 0, float* br = 0, VoicePool* pool = 0);
+      void setPart(SynthData* d) { next_data = d; }
       void on(unsigned char key, unsigned char velocity);
       void off(unsigned char velocity);
+      void steal(unsigned char key, unsigned char velocity);
+      void stop();
       void reset();
-      bool is_sustained() { return in_sustain; }
+      bool is_released() { return released; }
+      float level() const { return envs[0].current; }
       unsigned char get_key() const { return m_key; }
 
       // generates the sound for this voice
@@ -38,11 +38,17 @@ struct Osc {
         superWave.setStart(s);
     }
 
-    void resetPhase() {
-        virt.reset();
-        as.reset();
-        noise.reset();
-        superWave.reset();
+    // resets the engine of the type, the others are reset when selected
+    void resetPhase(int type) {
+        if (type < 29) {
+            virt.reset();
+        } else if (type < 32) {
+            as.reset();
+        } else if (type < 36) {
+            superWave.reset();
+        } else {
+            noise.reset();
+        }
     }
 
     void setSamplerate(float r) {
@@ -88,7 +94,6 @@ struct Filter {
     dsp::CombFilter comb;
     float buffer[BUFFER_SIZE];
     float prev_level;
-    float key_vel_to_f;
 
     Filter() {
         am.clear();
@@ -111,11 +116,52 @@ struct Filter {
         svf.setSamplerate(r);
         comb.setSamplerate(r);
     }
+
+    void setMemory(dsp::DelayMemory* m) {
+        comb.setMemory(m);
+    }
+};
+
+// one copy of the oscillator and filter path, a unison voice renders a
+// lane per stacked copy
+struct Lane {
+    Osc oscs[NOSC];
+    Filter filters[NDCF];
+    float bus_a[BUFFER_SIZE], bus_b[BUFFER_SIZE];
+    float* buffers[4];
+    // levels, pans and left/right gains of buses and filters at the last tick
+    float mix_level[4], mix_pan[4], mix_gain[4][2];
+
+    Lane() {
+        buffers[0] = bus_a;
+        buffers[1] = bus_b;
+        buffers[2] = filters[0].buffer;
+        buffers[3] = filters[1].buffer;
+        reset();
+    }
+
+    void reset() {
+        for (uint i = 0; i < NOSC; i++) oscs[i].reset();
+        for (uint i = 0; i < NDCF; i++) filters[i].reset();
+        std::memset(mix_gain, 0, sizeof(mix_gain));
+        std::memset(mix_level, 0, sizeof(mix_level));
+        std::memset(mix_pan, 0, sizeof(mix_pan));
+    }
+
+    void setSamplerate(float r) {
+        for (uint i = 0; i < NOSC; i++) oscs[i].setSamplerate(r);
+        for (uint i = 0; i < NDCF; i++) filters[i].setSamplerate(r);
+    }
+
+    void setMemory(dsp::DelayMemory* m) {
+        for (uint i = 0; i < NDCF; i++) filters[i].setMemory(m);
+    }
 };
 
 struct LFO {
     dsp::LFO lfo;
     float current, last;
+    float buffer[BUFFER_SIZE];
 
     void on() {
         lfo.reset();
@@ -136,6 +182,7 @@ struct LFO {
 struct Env {
     dsp::AHDSR env;
     float current, last;
+    float buffer[BUFFER_SIZE];
 
     void on() {
         env.on();
@@ -151,6 +198,45 @@ struct Env {
     }
 };
 
+// loop of the cycle cache of a voice
+struct Cache {
+    static const uint SIZE = 4096;
+    float buffer[2][SIZE];
+};
+
+// free list of preallocated items, taking and giving doesn't allocate
+template<class T, uint N>
+struct Pool {
+    T* items[N];
+    uint count = 0;
+
+    T* take() { return count > 0 ? items[--count] : 0; }
+    void give(T* item) { items[count++] = item; }
+};
+
+// elements shared by the voices, the lanes after the first of unison
+// voices own their comb lines, the cycle caches are taken by the steady
+// voices while they are recorded and played
+struct VoicePool {
+    static const uint CACHES = 64;
+
+    Pool<Lane, MAX_VOICES * (MAX_UNISON - 1)> lanes;
+    Pool<Cache, CACHES> caches;
+    Cache* cache_blocks;
+
+    VoicePool() : cache_blocks(new Cache[CACHES]) {
+        std::memset(cache_blocks, 0, CACHES * sizeof(Cache));
+        for (uint i = 0; i < CACHES; i++) caches.give(&cache_blocks[i]);
+    }
+
+    ~VoicePool() {
+        delete[] cache_blocks;
+    }
+
+    VoicePool(const VoicePool&) = delete;
+    VoicePool& operator=(const VoicePool&) = delete;
+};
+
 }
 
 #endif
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+
+void convolution_test() {
+    // random decaying response, long enough for both stages
+    const uint length = 5000;
+    std::vector<float> taps[2];
+    for (uint c = 0; c < 2; c++) {
+        taps[c].resize(length);
+        for (uint i = 0; i < length; i++) {
+            taps[c][i] = (float(rand()) / RAND_MAX - 0.5f) * expf(-float(i) / 1500.0f);
+        }
+    }
+    const float* data[2] = {&taps[0][0], &taps[1][0]};
+
+    dsp::ConvolutionReverb reverb;
+    reverb.setSamplerate(SR);
+    reverb.setCoefficients(1.0f);
+    reverb.setImpulse(std::make_shared<const dsp::ImpulseResponse>(data, 2, length));
+
+    // uneven block sizes
+    const int total = 12000;
+    std::vector<float> input(total), left(total), right(total);
+    for (int i = 0; i < total; i++) {
+        input[i] = left[i] = right[i] = float(rand()) / RAND_MAX - 0.5f;
+    }
+    int sizes[] = {1, 63, 64, 100, 7, 1024, 333};
+    for (int i = 0, k = 0; i < total; k++) {
+        int n = std::min(sizes[k % 7], total - i);
+        reverb.process(&left[i], &right[i], n);
+        i += n;
+    }
+
+    // compare against direct convolution
+    float* out[2] = {&left[0], &right[0]};
+    for (uint c = 0; c < 2; c++) {
+        float max_error = 0.0f;
+        for (int i = 0; i < total; i++) {
+            float y = 0.0f;
+            for (int t = 0; t < length && t <= i; t++) {
+                y += taps[c][t] * input[i - t];
+            }
+            max_error = std::max(max_error, fabsf(y - out[c][i]));
+        }
+        if (max_error > 1e-3) {
+            error("convolution error %f for channel %i", max_error, c);
+        }
+    }
+
+    // clear() drops the tail of the previous input, also when a worker is
+    // still computing it
+    dsp::Worker worker;
+    worker.start();
+    reverb.setWorker(&worker);
+    std::copy(input.begin(), input.end(), left.begin());
+    std::copy(input.begin(), input.end(), right.begin());
+    for (int i = 0; i < total; i += 100) {
+        reverb.process(&left[i], &right[i], std::min(100, total - i));
+    }
+    reverb.clear();
+    std::fill(left.begin(), left.end(), 0.0f);
+    std::fill(right.begin(), right.end(), 0.0f);
+    for (int i = 0; i < total; i += 100) {
+        reverb.process(&left[i], &right[i], std::min(100, total - i));
+    }
+    uint loud = 0;
+    for (int i = 0; i < total; i++) {
+        loud += left[i] != 0.0f || right[i] != 0.0f;
+    }
+    if (loud > 0) {
+        error("convolution tail after clear, %d samples", loud);
+    }
+
+    // a tail job held up on the worker drops the tail of two blocks, the
+    // input it skipped still reaches the tail so that the output matches
+    // the direct convolution again afterwards
+    struct HoldJob : dsp::Worker::Job {
+        std::atomic<bool> hold;
+        void work() { while (hold) std::this_thread::yield(); }
+    } holder;
+    holder.hold = true;
+    const uint T = dsp::ImpulseResponse::TAIL;
+    const uint blocks = total / T, late = 3;
+    dsp::ConvolutionReverb held;
+    held.setSamplerate(SR);
+    held.setCoefficients(1.0f);
+    held.setImpulse(std::make_shared<const dsp::ImpulseResponse>(data, 2, length));
+    held.setWorker(&worker);
+    std::copy(input.begin(), input.end(), left.begin());
+    std::copy(input.begin(), input.end(), right.begin());
+    for (uint b = 0; b < blocks; b++) {
+        if (b == late) {
+            worker.post(&holder);
+        }
+        held.process(&left[b * T], &right[b * T], T);
+        if (b == late + 1) {
+            holder.hold = false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    float max_error = 0.0f;
+    for (uint i = (late + 4) * T; i < blocks * T; i++) {
+        float y = 0.0f;
+        for (uint t = 0; t < length && t <= i; t++) {
+            y += taps[0][t] * input[i - t];
+        }
+        max_error = std::max(max_error, fabsf(y - left[i]));
+    }
+    if (max_error > 1e-3) {
+        error("convolution error %f after a late tail", max_error);
+    }
+}
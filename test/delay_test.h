@@ -25,3 +25,80 @@ void delay_test() {
         delaya.process(1.0);
     }
 }
+
+void delay_memory_test() {
+    dsp::DelayMemory memory;
+    memory.allocate(2 * 4096, 2, 1024);
+
+    // lines are rounded to powers of two
+    dsp::Delay delay(0);
+    dsp::DelayL delayl(0);
+    delay.setMax(3000, memory);
+    delayl.setMax(3000, memory);
+    if (delay.getLength() != 4096 || delayl.getLength() != 4096) {
+        error("delay length is not a power of two %i", delay.getLength());
+    }
+
+    // impulse comes out after the delay, also after wrapping
+    delay.setDelay(1000);
+    delayl.setDelay(1000.5);
+    for (int i = 0; i < 10000; i++) {
+        float in = (i % 2500) == 0 ? 1.0f : 0.0f;
+        float out = delay.process(in);
+        float outl = delayl.process(in);
+        float expected = (i >= 1000 && ((i - 1000) % 2500) == 0) ? 1.0f : 0.0f;
+        float expected2 = (i >= 1001 && ((i - 1001) % 2500) == 0) ? 1.0f : 0.0f;
+        if (out != expected) {
+            error("delay output wrong at %i", i);
+            break;
+        }
+        if (fabs(outl - 0.5f * (expected + expected2)) > 1e-6) {
+            error("delayl output wrong at %i", i);
+            break;
+        }
+    }
+
+    // arena is exhausted, lines fall back to own memory
+    dsp::DelayA delaya(0);
+    delaya.setMax(4096, memory);
+    if (delaya.getLength() != 4096) {
+        error("delaya has no memory %i", delaya.getLength());
+    }
+
+    // blocks
+    float* a = memory.acquire();
+    float* b = memory.acquire();
+    if (!a || !b || a == b || memory.acquire()) {
+        error("delay memory blocks wrong");
+    }
+    memory.release(a);
+    if (memory.acquire() != a) {
+        error("delay memory block not reused");
+    }
+
+    // lazily cleared lines read zeros until they are written
+    std::vector<float> dirty(1024, 1.0f);
+    dsp::DelayA lazy(0), cleared(1024);
+    lazy.attach(&dirty[0], 1024);
+    lazy.clearLazy();
+    lazy.setDelay(700.5);
+    cleared.setDelay(700.5);
+    for (int i = 0; i < 3000; i += 64) {
+        lazy.prepare(64);
+        for (int j = 0; j < 64; j++) {
+            float in = ((i + j) % 900) == 0 ? 1.0f : 0.0f;
+            if (lazy.process(in) != cleared.process(in)) {
+                error("lazily cleared delay wrong at %i", i + j);
+                i = 3000;
+                break;
+            }
+        }
+    }
+    lazy.detach();
+
+    // moves transfer the line
+    dsp::Delay moved(std::move(delay));
+    if (delay.getLength() != 0 || moved.getLength() != 4096) {
+        error("delay move failed %i", moved.getLength());
+    }
+}
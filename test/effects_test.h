@@ -27,11 +27,57 @@ void effects_test() {
         buffer[i] = buffer2[i] = (i == 0) ? 1 : 0;
     }
 
+    // multi tap chorus without modulation, taps meet at the delay
+    chorus_fx.clear();
+    chorus_fx.setCoefficients(0.01, 0.0, 0.3, 1.0, 0.0, 4);
+    chorus_fx.process(buffer, buffer2, SIZE);
+    uint d = 0.01 * SR;
+    if (fabs(buffer[d] - 1.0) > 1e-4 || fabs(buffer2[d] - 1.0) > 1e-4 || fabs(buffer[d + 1]) > 1e-4) {
+        error("chorus taps wrong %f %f", buffer[d], buffer2[d]);
+    }
+
+    for (uint i = 0; i < SIZE; i++) {
+        buffer[i] = buffer2[i] = (i == 0) ? 1 : 0;
+    }
+
     // phaser
     phaser_fx.setCoefficients(300.0, 0.5, 0.5, 0.5, 0.5);
     phaser_fx.process(buffer, buffer2, SIZE);
     write_wav((char*)"wavs/fx/phaser.wav", buffer);
 
+    // packed stages against a scalar chain, without sweep
+    for (uint st = 4; st <= 12; st += 4) {
+        dsp::PhaserEffect phaser;
+        phaser.setSamplerate(SR);
+        phaser.setCoefficients(300.0, 1000.0, 0.0, 1.0, 0.5, st);
+        dsp::AllpassDelay chain[12];
+        for (uint j = 0; j < st; j++) {
+            chain[j].setDelay(2.0 * 650.0 / SR);
+        }
+        float last = 0.0, max_error = 0.0;
+        for (uint i = 0; i < SIZE; i++) {
+            buffer[i] = buffer2[i] = (i % 1000 == 0) ? 1 : 0;
+        }
+        for (uint i = 0; i < 1000; i++) {
+            float x = buffer[i] + 0.5 * last;
+            for (uint j = 0; j < st; j++) {
+                x = chain[j].process(x);
+            }
+            last = x;
+            buffer2[i] = buffer[i] + last;
+        }
+        float right[1000];
+        std::copy(buffer, buffer + 1000, right);
+        phaser.process(buffer, right, 1000);
+        for (uint i = 0; i < 1000; i++) {
+            max_error = std::max(max_error, float(fabs(buffer[i] - buffer2[i])));
+            max_error = std::max(max_error, float(fabs(right[i] - buffer2[i])));
+        }
+        if (max_error > 1e-4) {
+            error("phaser error %f for %i stages", max_error, st);
+        }
+    }
+
     for (uint i = 0; i < SIZE; i++) {
         buffer[i] = buffer2[i] = (i == 0) ? 1 : 0;
     }
@@ -41,12 +87,145 @@ void effects_test() {
     delay_fx.process(buffer, buffer2, SIZE);
     write_wav((char*)"wavs/fx/delay.wav", buffer);
 
+    // block delay against a per sample reference, uneven blocks
+    {
+        dsp::DelayEffect fx;
+        fx.setSamplerate(SR);
+        fx.setCoefficients(164.0, 0.05, 0.03, 0.5, 0.7, 0.3, 100, 5000);
+        dsp::Delay ref_l, ref_r;
+        ref_l.setMax(2 * SR + 1);
+        ref_r.setMax(2 * SR + 1);
+        ref_l.setDelay(uint(SR / (164.0 / 60 / 0.05)));
+        ref_r.setDelay(uint(SR / (164.0 / 60 / 0.03)));
+        dsp::OnePole f1l, f2l, f1r, f2r;
+        f1l.clear(); f2l.clear(); f1r.clear(); f2r.clear();
+        f1l.setHighpass(100 / SR); f1r.setHighpass(100 / SR);
+        f2l.setLowpass(5000 / SR); f2r.setLowpass(5000 / SR);
+        float last_l = 0, last_r = 0, max_error = 0;
+        for (uint i = 0; i < SIZE; i++) {
+            buffer[i] = buffer2[i] = sin(i * 0.01) * (i < 2000 ? 1 : 0);
+        }
+        for (uint i = 0, k = 0; i < SIZE; k++) {
+            uint n = std::min(SIZE - i, 1u + (k * 37) % 300);
+            float ref[2][300];
+            for (uint j = 0; j < n; j++) {
+                float x = buffer[i + j];
+                float fl = f2l.process(f1l.process(0.7 * last_l + 0.3 * last_r));
+                float fr = f2r.process(f1r.process(0.7 * last_r + 0.3 * last_l));
+                last_l = ref_l.process(x + 0.7 * fl);
+                last_r = ref_r.process(x + 0.7 * fr);
+                ref[0][j] = x + 0.5 * last_l;
+                ref[1][j] = x + 0.5 * last_r;
+            }
+            fx.process(buffer + i, buffer2 + i, n);
+            for (uint j = 0; j < n; j++) {
+                max_error = std::max(max_error, float(fabs(buffer[i + j] - ref[0][j])));
+                max_error = std::max(max_error, float(fabs(buffer2[i + j] - ref[1][j])));
+            }
+            i += n;
+        }
+        if (max_error > 1e-4) {
+            error("delay block error %f", max_error);
+        }
+
+        // delay time changes are faded
+        fx.clear();
+        fx.setCoefficients(120.0, 0.25, 0.25, 1.0, 0.0, 0.0, 10, 20000);
+        float jump = 0;
+        for (uint i = 0; i < SIZE; i++) {
+            buffer[i] = buffer2[i] = sin(i * 0.01);
+        }
+        for (uint i = 0; i < SIZE; i += 64) {
+            if (i == SIZE / 2) {
+                fx.setCoefficients(100.0, 0.25, 0.25, 1.0, 0.0, 0.0, 10, 20000);
+            }
+            fx.process(buffer + i, buffer2 + i, std::min(64u, SIZE - i));
+        }
+        for (uint i = SIZE / 4; i < SIZE; i++) {
+            jump = std::max(jump, float(fabs(buffer[i] - buffer[i - 1])));
+        }
+        if (jump > 0.05) {
+            error("delay change not faded %f", jump);
+        }
+    }
+
     for (uint i = 0; i < SIZE; i++) {
         buffer[i] = buffer2[i] = (i == 0) ? 1 : 0;
     }
 
+    // delay falls asleep after its tail and wakes up on input
+    {
+        dsp::DelayEffect fx;
+        fx.setSamplerate(SR);
+        fx.setCoefficients(120.0, 0.25, 0.25, 0.5, 0.5, 0.0, 10, 10000);
+        float left[64], right[64];
+        uint blocks = 0;
+        for (; blocks < 5 * SIZE / 64 && !fx.asleep(); blocks++) {
+            for (uint i = 0; i < 64; i++) {
+                left[i] = right[i] = (blocks == 0 && i == 0) ? 1 : 0;
+            }
+            fx.run(left, right, 64);
+        }
+        if (!fx.asleep() || blocks * 64 < 0.5 * SR) {
+            error("delay sleep after %i blocks", blocks);
+        }
+        left[0] = right[0] = 1;
+        if (!fx.run(left, right, 64) || fx.asleep()) {
+            error("delay did not wake up");
+        }
+    }
+
     // reverb
     reverb_fx.setCoefficients(0.01, 0.5, 100, 5000, 0.5);
     reverb_fx.process(buffer, buffer2, SIZE);
     write_wav((char*)"wavs/fx/reverb.wav", buffer);
+
+    // the late reverb decays, also with a continuous input
+    for (uint i = 0; i < SIZE; i++) {
+        buffer[i] = buffer2[i] = 0.1 * (float(rand()) / RAND_MAX - 0.5);
+    }
+    reverb_fx.process(buffer, buffer2, SIZE);
+    // compare the bits, fast math doesn't keep nan comparisons
+    uint loud = 0;
+    for (uint i = 0; i < SIZE; i++) {
+        union { float f; uint32_t u; } v = {buffer[i]};
+        loud += (v.u & 0x7fffffff) >= 0x3f800000; // |x| >= 1, inf or nan
+    }
+    if (loud > 0) {
+        error("reverb unstable, %d loud samples", loud);
+    }
+
+    // limiter passes quiet input delayed and keeps loud input below the ceiling
+    {
+        dsp::Limiter limiter;
+        limiter.setSamplerate(SR);
+        limiter.setCoefficients(-1.0);
+        const float ceiling = powf(10.0f, -0.05f);
+        const uint latency = limiter.latency();
+        float input[SIZE];
+        for (uint i = 0; i < SIZE; i++) {
+            float amp = i < SIZE / 4 ? 0.5 : (i < SIZE / 2 ? 4.0 : (i % 5000 < 20 ? 8.0 : 0.2));
+            input[i] = amp * sin(2.0 * M_PI * 440.0 * i / SR);
+            buffer[i] = buffer2[i] = input[i];
+        }
+        for (uint i = 0; i < SIZE; i += 100) {
+            limiter.process(buffer + i, buffer2 + i, std::min(100u, SIZE - i));
+        }
+        for (uint i = latency; i < SIZE / 4; i++) {
+            if (fabs(buffer[i] - input[i - latency]) > 1e-5) {
+                error("limiter changed quiet input at %i", i);
+                break;
+            }
+        }
+        float peak = 0.0, held = 0.0;
+        for (uint i = 0; i < SIZE; i++) {
+            peak = std::max(peak, float(fabs(buffer[i])));
+        }
+        for (uint i = 3 * SIZE / 8; i < SIZE / 2; i++) {
+            held = std::max(held, float(fabs(buffer[i])));
+        }
+        if (peak > ceiling + 1e-5 || held < 0.9 * ceiling) {
+            error("limiter peak %f held %f", peak, held);
+        }
+    }
 }
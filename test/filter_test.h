@@ -1,5 +1,210 @@
+#include <complex>
 #include "wavutils.h"
 
+// magnitude response in dB of b0 + b1 z^-1 + b2 z^-2 / 1 + a1 z^-1 + a2 z^-2
+static double response_db(double* c, double omega) {
+    std::complex<double> z1 = std::polar(1.0, -omega);
+    std::complex<double> z2 = z1 * z1;
+    return 20.0 * log10(std::abs((c[0] + c[1] * z1 + c[2] * z2) / (1.0 + c[3] * z1 + c[4] * z2)) + 1e-30);
+}
+
+// magnitude response in dB of StateVariableFilter2 with k and g1 - g4 for
+// the LP, HP, BP and notch outputs
+static void svf_response_db(double k, double* g, double omega, double* out) {
+    std::complex<double> z1 = std::polar(1.0, -omega);
+    std::complex<double> a = 1.0 - (1.0 - g[1]) * z1;
+    std::complex<double> c = (g[2] + g[3] * g[0] * z1 / a) / (1.0 - z1);
+    std::complex<double> v3 = (1.0 + z1) / (1.0 + 2.0 * z1 * c);
+    std::complex<double> v1 = g[0] * v3 / a, v2 = c * v3;
+    std::complex<double> y[4] = {v2, 1.0 - k * v1 - v2, v1, 1.0 - k * v1};
+    for (int i = 0; i < 4; i++) {
+        out[i] = 20.0 * log10(std::abs(y[i]) + 1e-30);
+    }
+}
+
+// cutoff and resonance of the table tests, the cutoffs cover the audio band
+// at the doubled rate of the voices, every other resonance is close to 1
+// where the peak is sharpest, low cutoffs are left out for those as the
+// peak gets narrower than the float resolution of the coefficients
+static void table_point(int i, double& w, double& res) {
+    if (i % 2) {
+        w = 0.25 * pow(2.0, -6.0 * rand() / RAND_MAX);
+        res = 1.0 - 0.05 * pow(double(rand()) / RAND_MAX, 2.0);
+    } else {
+        w = 0.25 * pow(2.0, -9.0 * rand() / RAND_MAX);
+        res = 0.95 * rand() / RAND_MAX;
+    }
+}
+
+// frequency response error of the coefficient tables against the exact
+// formulas, on a grid and at the cutoff, notch and stopband depths below
+// -30 dB are skipped
+void filter_table_test() {
+    double max_error = 0.0, sum_error = 0.0;
+    int count = 0;
+    for (int i = 0; i < 2000; i++) {
+        double w, res;
+        table_point(i, w, res);
+
+        // exact
+        double r = std::max(0.001, 2.0 * (1.0 - res));
+        double k = tan(w * M_PI);
+        double k2 = k * k;
+        double rk = r * k;
+        double bh = 1.0 + rk + k2;
+        double b1 = (2.0 * (k2 - 1.0)) / bh;
+        double b2 = (1.0 - rk + k2) / bh;
+        double exact[3][5] = {
+            {k2 / bh, 2.0 * k2 / bh, k2 / bh, b1, b2},
+            {1.0 / bh, -2.0 / bh, 1.0 / bh, b1, b2},
+            {rk / bh, 0.0, -rk / bh, b1, b2}};
+
+        // table
+        float c[5];
+        dsp::biquad_.linear(w, res, c);
+        double table[3][5] = {
+            {c[0], 2.0 * c[0], c[0], c[3], c[4]},
+            {c[1], -2.0 * c[1], c[1], c[3], c[4]},
+            {c[2], 0.0, -c[2], c[3], c[4]}};
+
+        for (int type = 0; type < 3; type++) {
+            for (int j = 0; j < 200; j++) {
+                double omega = j == 0 ? 2.0 * M_PI * w : M_PI * j / 200.0;
+                double e = response_db(exact[type], omega);
+                if (e < -30.0) continue;
+                double error = fabs(e - response_db(table[type], omega));
+                max_error = std::max(max_error, error);
+                sum_error += error;
+                count++;
+            }
+        }
+    }
+
+    if (max_error > 1.0 || sum_error / count > 0.01) {
+        error("biquad table error too large %f %f", max_error, sum_error / count);
+    }
+
+    max_error = sum_error = 0.0;
+    count = 0;
+    for (int i = 0; i < 2000; i++) {
+        double w, res;
+        table_point(i, w, res);
+
+        // exact
+        double k = 1.0 - 0.99 * res;
+        double g = tan(w * M_PI);
+        double ginv = g / (1.0 + g * (g + k));
+        double exact[4] = {ginv, 2.0 * (g + k) * ginv, g * ginv, 2.0 * ginv};
+
+        // table
+        float c[4];
+        dsp::svf_.linear(w, res, c);
+        double table[4] = {c[0], c[1], c[2], c[3]};
+
+        for (int j = 0; j < 200; j++) {
+            double omega = j == 0 ? 2.0 * M_PI * w : M_PI * j / 200.0;
+            double e[4], t[4];
+            svf_response_db(k, exact, omega, e);
+            svf_response_db(k, table, omega, t);
+            for (int type = 0; type < 4; type++) {
+                if (e[type] < -30.0) continue;
+                double error = fabs(e[type] - t[type]);
+                max_error = std::max(max_error, error);
+                sum_error += error;
+                count++;
+            }
+        }
+    }
+
+    if (max_error > 1.0 || sum_error / count > 0.01) {
+        error("svf table error too large %f %f", max_error, sum_error / count);
+    }
+}
+
+// block state space biquad against the scalar DF2 recursion
+void filter_block_test() {
+    float input[SIZE * 4 + 3], expected[SIZE * 4 + 3], actual[SIZE * 4 + 3];
+    for (int i = 0; i < SIZE * 4 + 3; i++) {
+        input[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+    }
+
+    for (int type = 0; type < 2; type++) {
+        float w = (type == 0 ? 1000.0f : 50.0f) / SR;
+        dsp::BiQuadDF2 df2;
+        dsp::BiQuadBlock block;
+        df2.clear();
+        if (type == 0) {
+            df2.setLowpass(w, 0.5f);
+            block.setLowpass(w, 0.5f);
+        } else {
+            df2.setHighpass(w, 0.0f);
+            block.setHighpass(w, 0.0f);
+        }
+        for (int i = 0; i < SIZE * 4 + 3; i++) {
+            expected[i] = df2.process(input[i]);
+        }
+        // uneven block sizes to exercise the remainder path
+        block.process(input, actual, SIZE + 3);
+        block.process(input + SIZE + 3, actual + SIZE + 3, SIZE * 3);
+
+        float max_diff = 0.0f;
+        for (int i = 0; i < SIZE * 4 + 3; i++) {
+            max_diff = std::max(max_diff, fabsf(expected[i] - actual[i]));
+        }
+        if (max_diff > 1e-3f) {
+            error("block biquad %d differs from DF2 %f", type, max_diff);
+        }
+    }
+}
+
+// Moog and SVF2 with a small drive switched on midway, the switch to the
+// oversampled path doesn't step the output beyond the steps of the sine
+// through the undriven filter
+void filter_drive_test() {
+    const int BLOCK = 64, BLOCKS = 64;
+    float input[BLOCK], output[BLOCK];
+    for (int type = 0; type < 5; type++) {
+        dsp::MoogFilter moog[2];
+        dsp::StateVariableFilter2 svf2[2];
+        for (int j = 0; j < 2; j++) {
+            moog[j].clear();
+            moog[j].setSamplerate(SR);
+            svf2[j].clear();
+            svf2[j].setSamplerate(SR);
+            svf2[j].setType(type - 1);
+        }
+
+        float last[2] = {0.0f, 0.0f}, max_step[2] = {0.0f, 0.0f};
+        for (int n = 0; n < BLOCKS; n++) {
+            for (int i = 0; i < BLOCK; i++) {
+                input[i] = 0.8f * sin(2.0 * M_PI * 1000.0 * (n * BLOCK + i) / SR);
+            }
+            for (int j = 0; j < 2; j++) {
+                float d = j == 1 && n >= BLOCKS / 2 ? 0.0001f : 0.0f;
+                if (type == 0) {
+                    moog[j].setDistortion(d);
+                    moog[j].setCoefficients(1000.0, 0.9);
+                    moog[j].process(input, output, BLOCK);
+                } else {
+                    svf2[j].setDistortion(d);
+                    svf2[j].setCoefficients(1000.0, 0.9);
+                    svf2[j].process(input, output, BLOCK);
+                }
+                // steps after the filter has settled
+                for (int i = 0; i < BLOCK; i++) {
+                    if (n >= BLOCKS / 4) {
+                        max_step[j] = std::max(max_step[j], fabsf(output[i] - last[j]));
+                    }
+                    last[j] = output[i];
+                }
+            }
+        }
+        if (max_step[1] > 1.05f * max_step[0] + 0.01f) {
+            error("driven filter %i jumps by %f", type, max_step[1] - max_step[0]);
+        }
+    }
+}
+
 void filter_test() {
     char filename[50];
     float buffer[SIZE];
@@ -90,4 +295,78 @@ void filter_test() {
             write_wav(filename, buffer);
         }
     }
+
+    // coefficient ramping, cutoff sweep in 64 sample blocks
+    dsp::AmSynthFilter am;
+    am.setSamplerate(SR);
+    for (int i = 0; i < 6; i++) {
+        am.clear();
+        am.setType(i);
+        svf2.clear();
+        svf2.setType(i % 4);
+        for (int j = 0; j < SIZE; j += 64) {
+            float f = 100.0 + 9000.0 * float(j) / float(SIZE);
+            int samples = std::min(64, SIZE - j);
+            am.setCoefficients(f, 0.5);
+            am.process(noise + j, buffer + j, samples);
+            svf2.setCoefficients(f, 0.5);
+            svf2.process(noise + j, buffer2 + j, samples);
+        }
+
+        bool finite = true;
+        for (int j = 0; j < SIZE; j++) {
+            finite &= std::isfinite(buffer[j]) && std::isfinite(buffer2[j]);
+        }
+        if (!finite) {
+            error("filter sweep is not finite %i", i);
+        }
+
+        sprintf(filename, "wavs/filter/am_sweep_%i.wav", i);
+        write_wav(filename, buffer);
+        sprintf(filename, "wavs/filter/svf2_sweep_%i.wav", i);
+        write_wav(filename, buffer2);
+    }
+
+    // drive, hot input at full resonance
+    for (int i = 0; i < SIZE; i++) {
+        buffer2[i] = 4.0f * noise[i];
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            float d = float(j) / 3.0f;
+            if (i == 0) {
+                am.clear();
+                am.setType(j);
+                am.setDistortion(d);
+                am.setCoefficients(1000.0, 1.0);
+                am.process(buffer2, buffer, SIZE);
+            } else if (i == 1) {
+                moog.clear();
+                moog.setDistortion(d);
+                moog.setCoefficients(1000.0, 1.0);
+                moog.process(buffer2, buffer, SIZE);
+            } else {
+                svf2.clear();
+                svf2.setType(j);
+                svf2.setDistortion(d);
+                svf2.setCoefficients(1000.0, 1.0);
+                svf2.process(buffer2, buffer, SIZE);
+            }
+
+            bool finite = true;
+            for (int k = 0; k < SIZE; k++) {
+                finite &= std::isfinite(buffer[k]);
+            }
+            if (!finite) {
+                error("driven filter %i is not finite %i", i, j);
+            }
+
+            sprintf(filename, "wavs/filter/drive_%i%i.wav", i, j);
+            write_wav(filename, buffer);
+        }
+    }
+
+    filter_table_test();
+    filter_block_test();
+    filter_drive_test();
 }
@@ -2,6 +2,7 @@
 #include <omp.h>
 
 #include "delay.cpp"
+#include "effects.cpp"
 #include "filter.cpp"
 #include "oscillator.cpp"
 #include "tables.cpp"
@@ -20,15 +21,15 @@ int main() {
 
     dsp::Virtual va;
     va.setSamplerate(SR);
-    va.setFreq(440.0f);
+    va.setFreq(440.0f, 440.0f);
 
     dsp::AS as;
     as.setSamplerate(SR);
-    as.setFreq(440.0f);
+    as.setFreq(440.0f, 440.0f);
 
     dsp::Noise no;
     no.setSamplerate(SR);
-    no.setFreq(440.0f);
+    no.setFreq(440.0f, 440.0f);
 
     dsp::MoogFilter moog;
     moog.setSamplerate(SR);
@@ -42,9 +43,19 @@ int main() {
     svf2.setSamplerate(SR);
     svf2.setCoefficients(1000.0, 0.5);
 
+    dsp::BiQuadDF2 df2;
+    df2.setLowpass(1000.0 / SR, 0.5);
+
+    dsp::BiQuadBlock block;
+    block.setLowpass(1000.0 / SR, 0.5);
+
+    dsp::ReverbEffect reverb;
+    reverb.setSamplerate(SR);
+    reverb.setCoefficients(0.02, 0.7, 50.0, 8000.0, 0.3);
+
     // noise input
     float noise[SIZE];
-    no.setFreq(1000.0);
+    no.setFreq(1000.0, 1000.0);
     no.setType(0);
     no.process(noise, buffer, SIZE);
 
@@ -119,4 +130,109 @@ int main() {
         double end = omp_get_wtime();
         log("svf2", i, end - start);
     }
+
+    // biquad, scalar vs block
+    {
+        df2.clear();
+        double start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            for (int k = 0; k < SIZE; k++) {
+                buffer[k] = df2.process(noise[k]);
+            }
+        }
+        double end = omp_get_wtime();
+        log("biquad", 0, end - start);
+
+        block.clear();
+        start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            block.process(noise, buffer, SIZE);
+        }
+        end = omp_get_wtime();
+        log("biquad", 1, end - start);
+    }
+
+    // chorus
+    for (uint t = 1; t <= 4; t++) {
+        dsp::ChorusEffect chorus;
+        chorus.setSamplerate(SR);
+        chorus.setCoefficients(0.02, 0.3, 0.5, 0.3, 0.2, t);
+        float left[SIZE], right[SIZE];
+        double start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            for (int k = 0; k < SIZE; k++) {
+                left[k] = right[k] = noise[k];
+            }
+            chorus.process(left, right, SIZE);
+        }
+        double end = omp_get_wtime();
+        log("chorus", t, end - start);
+    }
+
+    // phaser
+    for (uint st = 4; st <= 12; st += 4) {
+        dsp::PhaserEffect phaser;
+        phaser.setSamplerate(SR);
+        phaser.setCoefficients(300.0, 3000.0, 0.5, 0.3, 0.5, st);
+        float left[SIZE], right[SIZE];
+        double start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            for (int k = 0; k < SIZE; k++) {
+                left[k] = right[k] = noise[k];
+            }
+            phaser.process(left, right, SIZE);
+        }
+        double end = omp_get_wtime();
+        log("phaser", st, end - start);
+    }
+
+    // reverb
+    {
+        float left[SIZE], right[SIZE];
+        for (int k = 0; k < SIZE; k++) {
+            left[k] = right[k] = noise[k];
+        }
+        double start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            reverb.process(left, right, SIZE);
+        }
+        double end = omp_get_wtime();
+        log("reverb", 0, end - start);
+    }
+
+    // limiter against the volume and DC blockers next to it
+    {
+        dsp::DCBlocker dc_l, dc_r;
+        dc_l.setSamplerate(SR);
+        dc_r.setSamplerate(SR);
+        float left[SIZE], right[SIZE];
+        // both loops refill the input, so the signal doesn't decay to denormals
+        double start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            for (int k = 0; k < SIZE; k++) {
+                left[k] = right[k] = noise[k];
+            }
+            dc_l.process(left, left, SIZE);
+            dc_r.process(right, right, SIZE);
+            for (int k = 0; k < SIZE; k++) {
+                left[k] = 0.5f * left[k];
+                right[k] = 0.5f * right[k];
+            }
+        }
+        double end = omp_get_wtime();
+        log("dc+volume", 0, end - start);
+
+        dsp::Limiter limiter;
+        limiter.setSamplerate(SR);
+        limiter.setCoefficients(-6.0);
+        start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            for (int k = 0; k < SIZE; k++) {
+                left[k] = right[k] = noise[k];
+            }
+            limiter.process(left, right, SIZE);
+        }
+        end = omp_get_wtime();
+        log("limiter", 0, end - start);
+    }
 }
@@ -1,5 +1,6 @@
 #include <sndfile.hh>
 
+#include "convolution.cpp"
 #include "delay.cpp"
 #include "effects.cpp"
 #include "envelope.cpp"
@@ -7,6 +8,8 @@
 #include "lfo.cpp"
 #include "oscillator.cpp"
 #include "tables.cpp"
+#include "tuning.cpp"
+#include "worker.cpp"
 
 #include <iostream>
 
@@ -29,24 +32,31 @@ static void error(const char* text, T val, U val2) {
 }
 
 #include "wavutils.h"
+#include "convolution_test.h"
 #include "delay_test.h"
 #include "effects_test.h"
 #include "envelope_test.h"
 #include "filter_test.h"
 #include "lfo_test.h"
 #include "oscillator_test.h"
+#include "tuning_test.h"
+#include "worker_test.h"
 
 int main() {
     // ?!?
     dsp::DCBlocker dcBlocker;
     dcBlocker.setSamplerate(SR);
 
+    convolution_test();
     delay_test();
+    delay_memory_test();
     effects_test();
     envelope_test();
     filter_test();
     lfo_test();
     oscillator_test();
+    tuning_test();
+    worker_test();
 
     return 0;
 }
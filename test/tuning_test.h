@@ -0,0 +1,46 @@
+void tuning_test() {
+    dsp::Tuning tuning;
+
+    // equal temperament, fractional keys in cents
+    if (fabs(tuning.freq(69.0) - 440.0) > 1e-3 || fabs(tuning.freq(60.0) - 261.6256) > 1e-3) {
+        error("equal temperament %f %f", tuning.freq(69.0), tuning.freq(60.0));
+    }
+    if (fabs(tuning.freq(69.5) - 440.0 * pow(2.0, 1.0 / 24.0)) > 1e-3) {
+        error("quarter tone %f", tuning.freq(69.5));
+    }
+
+    // just intonation around middle C
+    FILE* f = fopen("wavs/just.scl", "w");
+    fprintf(f, "! comment\njust\n 12\n!\n 16/15\n 9/8\n 6/5\n 5/4\n 4/3\n 45/32\n 3/2\n 8/5\n 5/3\n 9/5\n 15/8\n 2/1\n");
+    fclose(f);
+    if (!tuning.load("wavs/just.scl")) {
+        error("just scale not loaded");
+    }
+    if (fabs(tuning.freq(67.0) / tuning.freq(60.0) - 1.5) > 1e-5 || fabs(tuning.freq(72.0) / tuning.freq(48.0) - 4.0) > 1e-5) {
+        error("just fifth %f, octaves %f", tuning.freq(67.0) / tuning.freq(60.0), tuning.freq(72.0) / tuning.freq(48.0));
+    }
+
+    // mapping with a reference pitch, every other key unmapped
+    f = fopen("wavs/ref.kbm", "w");
+    fprintf(f, "2\n0\n127\n60\n62\n432.0\n1\n0\nx\n");
+    fclose(f);
+    if (!tuning.load("wavs/just.scl", "wavs/ref.kbm")) {
+        error("mapping not loaded");
+    }
+    if (fabs(tuning.freq(62.0) - 432.0) > 1e-3 || tuning.freq(63.0) != tuning.freq(62.0)) {
+        error("mapped key %f, unmapped key %f", tuning.freq(62.0), tuning.freq(63.0));
+    }
+    // keys 62 and 64 are on degrees 1 and 2
+    if (fabs(tuning.freq(64.0) / tuning.freq(62.0) - (9.0 / 8.0) / (16.0 / 15.0)) > 1e-5) {
+        error("mapped step %f", tuning.freq(64.0) / tuning.freq(62.0));
+    }
+
+    // broken files leave the tuning unchanged
+    f = fopen("wavs/broken.scl", "w");
+    fprintf(f, "broken\n 3\n 9/8\n");
+    fclose(f);
+    float before = tuning.freq(62.0);
+    if (tuning.load("wavs/broken.scl") || tuning.load("wavs/missing.scl") || tuning.freq(62.0) != before) {
+        error("broken scale loaded");
+    }
+}
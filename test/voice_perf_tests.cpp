@@ -7,6 +7,7 @@
 #include "envelope.cpp"
 #include "voice.cpp"
 #include "tables.cpp"
+#include "tuning.cpp"
 
 #define SIZE 64
 #define SR 44100
@@ -16,6 +17,10 @@ void log(const char* label, float duration) {
     std::cout << label << " " << duration << std::endl;
 }
 
+void log(const char* label, int type, float duration) {
+    std::cout << label << " " << type << " " << duration << std::endl;
+}
+
 int main() {
     float buffer_l[SIZE];
     float buffer_r[SIZE];
@@ -31,7 +36,6 @@ int main() {
 
     rogue::SynthData data;
     data.playmode = 0;
-    data.volume = 0.5;
     data.oversample = 1;
     data.bus_a_level = 0.5;
     data.bus_a_pan = 0.5;
@@ -85,13 +89,44 @@ int main() {
     rogue::rogueVoice voice(SR, &data, buffer_l, buffer_r);
     voice.set_port_buffers(ports);
 
-    double start = omp_get_wtime();
-    for (int j = 0; j < ITERATIONS; j++) {
-        voice.on(69, 64);
-        voice.render(0, SIZE / 2);
-        voice.off(0);
-        voice.render(SIZE / 2, SIZE);
+    // control rates
+    for (uint rate = 8; rate <= SIZE; rate *= 2) {
+        data.control_rate = rate;
+        double start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            voice.on(69, 64);
+            voice.render(0, SIZE / 2);
+            voice.off(0);
+            voice.render(SIZE / 2, SIZE);
+        }
+        double end = omp_get_wtime();
+        log("voice", rate, end - start);
+    }
+
+    // unison lanes
+    rogue::VoicePool pool;
+    rogue::Lane* pool_lanes = new rogue::Lane[MAX_UNISON - 1];
+    for (uint i = 0; i < MAX_UNISON - 1; i++) {
+        pool_lanes[i].setSamplerate(SR);
+        pool_lanes[i].setMemory(0);
+        pool.lanes.give(&pool_lanes[i]);
+    }
+    rogue::rogueVoice unison_voice(SR, &data, buffer_l, buffer_r, 0, 0, 0, &pool);
+    unison_voice.set_port_buffers(ports);
+    data.control_rate = SIZE;
+    data.unison_detune = 0.2f;
+    data.unison_spread = 0.5f;
+    for (uint lanes = 1; lanes <= MAX_UNISON; lanes *= 2) {
+        data.unison = lanes;
+        double start = omp_get_wtime();
+        for (int j = 0; j < ITERATIONS; j++) {
+            unison_voice.on(69, 64);
+            unison_voice.render(0, SIZE / 2);
+            unison_voice.off(0);
+            unison_voice.render(SIZE / 2, SIZE);
+        }
+        double end = omp_get_wtime();
+        log("unison", lanes, end - start);
     }
-    double end = omp_get_wtime();
-    log("voice", end - start);
+    delete[] pool_lanes;
 }
@@ -7,6 +7,7 @@
 #include "envelope.cpp"
 #include "voice.cpp"
 #include "tables.cpp"
+#include "tuning.cpp"
 
 #define SR 44100.0
 #define SIZE 44100
@@ -40,7 +41,6 @@ int main() {
     ports.push_back(buffer_r);
 
     rogue::SynthData data;
-    data.volume = 0.5;
     data.oversample = 1;
     data.bus_a_level = 0.5;
     data.bus_a_pan = 0.5;
@@ -115,4 +115,72 @@ int main() {
     sprintf(filename, "wavs/voice_%i.wav", 2);
     write_wav(filename, buffer_l);
 
+    // audio rate modulation
+    data.lfos[0].freq = 40.0f;
+    data.mods[0].src = M_LFO1_BI;
+    data.mods[0].target = M_OSC1_P;
+    data.mods[0].amount = 0.1;
+    data.mods[0].audio = true;
+    data.mods[1].src = M_LFO1_UN;
+    data.mods[1].target = M_DCF1_F;
+    data.mods[1].amount = 0.5;
+    data.mods[1].audio = true;
+    data.mod_count = 2;
+    data.audio_sources[M_LFO1_BI] = true;
+    data.audio_sources[M_LFO1_UN] = true;
+    data.audio_targets[M_OSC1_P] = true;
+    data.audio_targets[M_DCF1_F] = true;
+
+    voice.on(69, 64);
+    voice.render(0, SIZE / 2);
+    voice.off(0);
+    voice.render(SIZE / 2, SIZE);
+
+    sprintf(filename, "wavs/voice_%i.wav", 3);
+    write_wav(filename, buffer_l);
+
+    // unison voices with two comb filters, more than the arena has blocks
+    // for when every lane takes one
+    const uint VOICES = 24, LENGTH = 4410;
+    rogue::SynthData comb_data = data;
+    comb_data.mod_count = 0;
+    std::fill(comb_data.audio_sources, comb_data.audio_sources + M_SIZE, false);
+    std::fill(comb_data.audio_targets, comb_data.audio_targets + M_TARGET_SIZE, false);
+    comb_data.unison = MAX_UNISON;
+    comb_data.unison_detune = 0.2f;
+    comb_data.unison_spread = 0.5f;
+    for (uint i = 0; i < NDCF; i++) {
+        comb_data.filters[i] = data.filters[0];
+        comb_data.filters[i].type = 11;
+        comb_data.filters[i].freq = 200.0f * (i + 1);
+    }
+
+    dsp::DelayMemory memory;
+    memory.allocate(0, MAX_VOICES * NDCF, dsp::next_pow2(SR / 20.0));
+    rogue::VoicePool pool;
+    rogue::Lane* pool_lanes = new rogue::Lane[VOICES * (MAX_UNISON - 1)];
+    for (uint i = 0; i < VOICES * (MAX_UNISON - 1); i++) {
+        pool_lanes[i].setSamplerate(SR);
+        pool_lanes[i].setMemory(0);
+        pool.lanes.give(&pool_lanes[i]);
+    }
+
+    std::vector<float> out_l(VOICES * LENGTH), out_r(VOICES * LENGTH);
+    std::vector<rogue::rogueVoice*> voices;
+    for (uint v = 0; v < VOICES; v++) {
+        voices.push_back(new rogue::rogueVoice(SR, &comb_data, &out_l[v * LENGTH], &out_r[v * LENGTH], &memory, 0, 0, &pool));
+        voices[v]->on(60, 64);
+    }
+    for (uint v = 0; v < VOICES; v++) {
+        voices[v]->render(0, LENGTH);
+    }
+    for (uint v = 1; v < VOICES; v++) {
+        if (!std::equal(&out_l[0], &out_l[LENGTH], &out_l[v * LENGTH])) {
+            std::cout << "unison comb voice " << v << " differs" << std::endl;
+        }
+    }
+    for (uint v = 0; v < VOICES; v++) {
+        delete voices[v];
+    }
+    delete[] pool_lanes;
 }
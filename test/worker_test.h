@@ -0,0 +1,42 @@
+#include <thread>
+
+// counts its runs, posted from two threads at once
+struct CountJob : dsp::Worker::Job {
+    std::atomic<int> runs;
+    CountJob() : runs(0) {}
+    void work() { runs++; }
+};
+
+void worker_test() {
+    const int POSTS = 10000;
+    dsp::Worker worker;
+    worker.start();
+    CountJob jobs[2];
+    int posted[2] = {0, 0};
+    auto poster = [&](int t) {
+        for (int i = 0; i < POSTS; i++) {
+            // a full queue is retried
+            while (!worker.post(&jobs[t])) {
+                std::this_thread::yield();
+            }
+            posted[t]++;
+        }
+    };
+    std::thread other(poster, 1);
+    poster(0);
+    other.join();
+
+    // the queue drains before the worker is stopped
+    for (int i = 0; i < 1000 && jobs[0].runs + jobs[1].runs < 2 * POSTS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    worker.stop();
+    for (int t = 0; t < 2; t++) {
+        if (jobs[t].runs != posted[t]) {
+            error("worker ran %d of %d jobs", int(jobs[t].runs), posted[t]);
+        }
+    }
+    if (worker.post(&jobs[0])) {
+        error("worker took a job after stop");
+    }
+}